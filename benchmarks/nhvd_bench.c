@@ -0,0 +1,604 @@
+/*
+ * NHVD Network Hardware Video Decoder benchmark
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This benchmark measures library throughput and latency without NHVE and hardware encoder:
+ * - video is encoded up front with libavcodec software encoder or read from raw file
+ * - local MLSP client streams it over loopback at requested framerate
+ * - last channel is auxiliary and carries send timestamp (and padding)
+ * - decoded framerate, end-to-end latency percentiles and CPU use are reported
+ *
+ * Decoder options (nhvd_hw_config knobs) are comma separated, e.g. "skip_loop_filter=2,threads=2":
+ * - skip_loop_filter=0/1/2 (NHVD_SKIP_NONE, NHVD_SKIP_NONREF, NHVD_SKIP_ALL)
+ * - skip_nonref=0/1
+ * - low_delay=0/1
+ * - threads=N
+ * - lowres=1/2/3 (e.g. mpeg4)
+ * - b_frames=N encoder option, without B-frames there are no non-reference frames to skip
+ * - decoder_init=0/1/2 (NHVD_INIT_SEQUENTIAL, NHVD_INIT_PARALLEL, NHVD_INIT_LAZY)
+ *
+ * Network options (nhvd_net_config socket and thread tuning) go to the same list:
+ * - receive_buffer_size=BYTES
+ * - busy_poll_us=N
+ * - kernel_timestamps=0/1
+ *   (socket options above need library built with NHVD_MLSP_SOCKET)
+ * - network_cpus=MASK, decoding_cpus=MASK (e.g. 0x4)
+ * - realtime_priority=N with SCHED_FIFO
+ *
+ */
+
+#include "../nhvd.h"
+
+// Minimal Latency Streaming Protocol library
+#include "mlsp.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h> //getrusage
+
+struct packet
+{
+	uint8_t *data;
+	int size;
+};
+
+struct video
+{
+	struct packet *packets;
+	int size;
+	const char *decoder; //e.g. "h264"
+};
+
+struct bench_config
+{
+	const char *hardware;
+	const char *source; //encoder name or raw file
+	const char *device;
+	int width;
+	int height;
+	int fps;
+	int channels; //video channels
+	int aux_size; //auxiliary payload size, at least timestamp size
+	int frames;
+	int receive_queue_size;
+	const char *options; //decoder options
+	struct nhvd_hw_config knobs; //parsed decoder options
+	int b_frames;
+	struct nhvd_net_config tuning; //parsed network options
+};
+
+struct sender_args
+{
+	const struct bench_config *config;
+	const struct video *video;
+};
+
+int encode_video(const struct bench_config *config, struct video *video);
+int read_video(const struct bench_config *config, struct video *video);
+int add_packet(struct video *video, const uint8_t *data, int size);
+void free_video(struct video *video);
+void *sender_thread(void *arg);
+void receive_loop(struct nhvd *network_decoder, const struct bench_config *config, double *latencies_ms, int *decoded);
+void report(struct nhvd *network_decoder, const struct bench_config *config,
+	double *latencies_ms, int latencies, int decoded, double wall_s, double cpu_s);
+int compare_double(const void *a, const void *b);
+int64_t time_ns();
+double cpu_s();
+int process_user_input(int argc, char **argv, struct bench_config *config);
+int parse_options(struct bench_config *config);
+
+//network configuration
+const char *IP=NULL; //listen on any
+const uint16_t PORT=9766;
+const int TIMEOUT_MS=500;
+
+int main(int argc, char **argv)
+{
+	struct bench_config config = {0};
+	struct video video = {0};
+	double *latencies_ms, wall_s, cpu_start;
+	int64_t wall_start;
+	int decoded = 0, status;
+	pthread_t sender;
+
+	if(process_user_input(argc, argv, &config) != 0)
+		return 1;
+
+	if(strstr(config.source, ".h264") || strstr(config.source, ".hevc") || strstr(config.source, ".h265"))
+		status = read_video(&config, &video);
+	else
+		status = encode_video(&config, &video);
+
+	if(status != 0 || video.size == 0)
+	{
+		fprintf(stderr, "failed to prepare video\n");
+		free_video(&video);
+		return 2;
+	}
+
+	config.frames = video.size;
+
+	struct nhvd_net_config net_config = {IP, PORT, TIMEOUT_MS, config.receive_queue_size};
+	net_config.decoder_init = config.tuning.decoder_init;
+	net_config.receive_buffer_size = config.tuning.receive_buffer_size;
+	net_config.busy_poll_us = config.tuning.busy_poll_us;
+	net_config.kernel_timestamps = config.tuning.kernel_timestamps;
+	net_config.network_cpus = config.tuning.network_cpus;
+	net_config.decoding_cpus = config.tuning.decoding_cpus;
+	net_config.realtime_policy = config.tuning.realtime_policy;
+	net_config.realtime_priority = config.tuning.realtime_priority;
+	struct nhvd_hw_config hw_config[config.channels];
+
+	for(int i=0;i<config.channels;++i)
+	{
+		struct nhvd_hw_config hw = config.knobs;
+
+		hw.hardware = config.hardware;
+		hw.codec = video.decoder;
+		hw.device = config.device;
+		hw.width = config.width;
+		hw.height = config.height;
+		hw_config[i] = hw;
+	}
+
+	struct nhvd *network_decoder = nhvd_init(&net_config, hw_config, config.channels, 1);
+
+	if( !network_decoder || (latencies_ms = (double*)calloc(config.frames * config.channels, sizeof(double))) == NULL)
+	{
+		fprintf(stderr, "failed to initialize nhvd\n");
+		nhvd_close(network_decoder);
+		free_video(&video);
+		return 3;
+	}
+
+	struct sender_args args = {&config, &video};
+
+	wall_start = time_ns();
+	cpu_start = cpu_s();
+
+	if(pthread_create(&sender, NULL, sender_thread, &args) != 0)
+	{
+		fprintf(stderr, "failed to create sender thread\n");
+		free(latencies_ms);
+		nhvd_close(network_decoder);
+		free_video(&video);
+		return 4;
+	}
+
+	receive_loop(network_decoder, &config, latencies_ms, &decoded);
+
+	pthread_join(sender, NULL);
+
+	//don't account final timeout
+	wall_s = (time_ns() - wall_start) / 1000000000.0 - TIMEOUT_MS / 1000.0;
+
+	report(network_decoder, &config, latencies_ms, decoded, decoded, wall_s, cpu_s() - cpu_start);
+
+	free(latencies_ms);
+	nhvd_close(network_decoder);
+	free_video(&video);
+
+	return 0;
+}
+
+int encode_video(const struct bench_config *config, struct video *video)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name(config->source);
+	AVCodecContext *ctx = NULL;
+	AVFrame *frame = av_frame_alloc();
+	AVPacket *packet = av_packet_alloc();
+	int status = -1;
+
+	if(!codec || !frame || !packet || (ctx = avcodec_alloc_context3(codec)) == NULL)
+	{
+		fprintf(stderr, "failed to find or allocate encoder %s\n", config->source);
+		goto cleanup;
+	}
+
+	ctx->width = config->width;
+	ctx->height = config->height;
+	ctx->time_base = (AVRational){1, config->fps};
+	ctx->framerate = (AVRational){config->fps, 1};
+	ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	ctx->gop_size = config->fps;
+	ctx->max_b_frames = config->b_frames;
+	ctx->bit_rate = (int64_t)config->width * config->height * config->fps / 10;
+
+	av_opt_set(ctx->priv_data, "preset", "ultrafast", 0); //ignored if not supported
+
+	//zerolatency disables B-frames, non-reference B-frames for skip_nonref
+	if(config->b_frames)
+		av_opt_set(ctx->priv_data, "x264-params", "b-pyramid=none", 0);
+	else
+		av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+
+	if(avcodec_open2(ctx, codec, NULL) < 0)
+	{
+		fprintf(stderr, "failed to open encoder %s\n", config->source);
+		goto cleanup;
+	}
+
+	video->decoder = avcodec_get_name(codec->id);
+
+	frame->width = ctx->width;
+	frame->height = ctx->height;
+	frame->format = ctx->pix_fmt;
+
+	if(av_frame_get_buffer(frame, 32) < 0)
+		goto cleanup;
+
+	//NULL frame flushes the encoder at the end
+	for(int f=0;f <= config->frames;++f)
+	{
+		//procedurally generated moving pattern
+		for(int y=0;f < config->frames && y < ctx->height;++y)
+			for(int x=0;x < ctx->width;++x)
+				frame->data[0][y * frame->linesize[0] + x] = x + y + f * 3;
+
+		for(int y=0;f < config->frames && y < ctx->height / 2;++y)
+			for(int x=0;x < ctx->width / 2;++x)
+			{
+				frame->data[1][y * frame->linesize[1] + x] = 128 + y + f * 2;
+				frame->data[2][y * frame->linesize[2] + x] = 64 + x + f * 5;
+			}
+
+		frame->pts = f;
+
+		if(avcodec_send_frame(ctx, f < config->frames ? frame : NULL) < 0)
+			goto cleanup;
+
+		while(avcodec_receive_packet(ctx, packet) == 0)
+		{
+			int error = add_packet(video, packet->data, packet->size);
+
+			av_packet_unref(packet);
+
+			if(error)
+				goto cleanup;
+		}
+	}
+
+	status = 0;
+
+cleanup:
+	avcodec_free_context(&ctx);
+	av_packet_free(&packet);
+	av_frame_free(&frame);
+
+	return status;
+}
+
+int read_video(const struct bench_config *config, struct video *video)
+{
+	const int hevc = strstr(config->source, ".h264") == NULL;
+	const AVCodec *codec = avcodec_find_decoder(hevc ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+	AVCodecParserContext *parser = NULL;
+	AVCodecContext *ctx = NULL;
+	FILE *file = fopen(config->source, "rb");
+	uint8_t *data = NULL;
+	long file_size;
+	int status = -1;
+
+	if(!file || !codec || (parser = av_parser_init(codec->id)) == NULL || (ctx = avcodec_alloc_context3(codec)) == NULL)
+	{
+		fprintf(stderr, "failed to open %s\n", config->source);
+		goto cleanup;
+	}
+
+	video->decoder = codec->name;
+
+	fseek(file, 0, SEEK_END);
+	file_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if( (data = (uint8_t*)calloc(file_size + AV_INPUT_BUFFER_PADDING_SIZE, 1)) == NULL ||
+		fread(data, 1, file_size, file) != (size_t)file_size)
+		goto cleanup;
+
+	//split Annex B stream into access units, size 0 at the end flushes the parser
+	for(long offset=0; offset <= file_size && video->size < config->frames;)
+	{
+		uint8_t *out;
+		int out_size;
+		const int used = av_parser_parse2(parser, ctx, &out, &out_size,
+			data + offset, file_size - offset, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+
+		if(out_size && add_packet(video, out, out_size) != 0)
+			goto cleanup;
+
+		if(offset == file_size && !out_size)
+			break;
+
+		offset += used;
+	}
+
+	status = 0;
+
+cleanup:
+	free(data);
+	av_parser_close(parser);
+	avcodec_free_context(&ctx);
+
+	if(file)
+		fclose(file);
+
+	return status;
+}
+
+int add_packet(struct video *video, const uint8_t *data, int size)
+{
+	struct packet *packets = (struct packet*)realloc(video->packets, (video->size + 1) * sizeof(struct packet));
+
+	if(!packets)
+		return -1;
+
+	video->packets = packets;
+
+	if( (packets[video->size].data = (uint8_t*)malloc(size)) == NULL)
+		return -1;
+
+	memcpy(packets[video->size].data, data, size);
+	packets[video->size].size = size;
+	++video->size;
+
+	return 0;
+}
+
+void free_video(struct video *video)
+{
+	for(int i=0;i<video->size;++i)
+		free(video->packets[i].data);
+
+	free(video->packets);
+	video->packets = NULL;
+	video->size = 0;
+}
+
+void *sender_thread(void *arg)
+{
+	const struct sender_args *args = (struct sender_args*)arg;
+	const struct bench_config *config = args->config;
+	struct mlsp_config mlsp_config = {"127.0.0.1", PORT, 0, config->channels + 1};
+	struct mlsp *streamer = mlsp_init_client(&mlsp_config);
+	uint8_t *aux = (uint8_t*)calloc(config->aux_size, 1);
+	const int64_t interval_ns = 1000000000LL / config->fps;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for(int f=0;streamer && aux && f < args->video->size;++f)
+	{
+		const struct mlsp_frame video_frame = {args->video->packets[f].data, args->video->packets[f].size};
+		const struct mlsp_frame aux_frame = {aux, config->aux_size};
+		const int64_t now = time_ns();
+
+		memcpy(aux, &now, sizeof(now));
+
+		for(int c=0;c<config->channels;++c)
+			mlsp_send(streamer, &video_frame, c);
+
+		mlsp_send(streamer, &aux_frame, config->channels);
+
+		next.tv_nsec += interval_ns;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	free(aux);
+	mlsp_close(streamer);
+
+	return NULL;
+}
+
+void receive_loop(struct nhvd *network_decoder, const struct bench_config *config, double *latencies_ms, int *decoded)
+{
+	AVFrame *frames[config->channels];
+	struct nhvd_frame raws[config->channels + 1];
+	int status, received = 0;
+
+	while( (status = nhvd_receive_all(network_decoder, frames, raws)) != NHVD_ERROR )
+	{
+		if(status == NHVD_TIMEOUT)
+		{
+			if(received)
+				break; //sender finished
+			continue; //waiting for sender
+		}
+
+		++received;
+
+		if(raws[config->channels].size < (int)sizeof(int64_t))
+			continue;
+
+		int64_t sent;
+		memcpy(&sent, raws[config->channels].data, sizeof(sent));
+
+		for(int c=0;c<config->channels;++c)
+			if(frames[c])
+				latencies_ms[(*decoded)++] = (time_ns() - sent) / 1000000.0;
+	}
+}
+
+void report(struct nhvd *network_decoder, const struct bench_config *config,
+	double *latencies_ms, int latencies, int decoded, double wall_s, double cpu_s)
+{
+	struct nhvd_stats stats;
+	struct nhvd_channel_stats channel_stats[config->channels + 1];
+
+	qsort(latencies_ms, latencies, sizeof(double), compare_double);
+
+	printf("source           %s (%s) %dx%d@%d\n", config->source, config->hardware, config->width, config->height, config->fps);
+	printf("video channels   %d\n", config->channels);
+	printf("decoder options  %s\n", config->options ? config->options : "none");
+	printf("frames           %d sent, %d decoded\n", config->frames * config->channels, decoded);
+	printf("decoded fps      %.2f\n", wall_s > 0 ? decoded / wall_s / config->channels : 0);
+	printf("cpu use          %.1f%% of single core\n", wall_s > 0 ? 100.0 * cpu_s / wall_s : 0);
+
+	if(latencies)
+		printf("latency ms       p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+		latencies_ms[latencies * 50 / 100], latencies_ms[latencies * 90 / 100],
+		latencies_ms[latencies * 99 / 100], latencies_ms[latencies - 1]);
+
+	if(nhvd_get_stats(network_decoder, &stats, channel_stats) != NHVD_OK)
+		return;
+
+	//the sender starts right after nhvd_init
+	printf("startup ms       init %.3f first frame %.3f\n", stats.init_ms, stats.first_frame_ms);
+	printf("socket           buffer %d drops %llu\n", stats.socket_buffer_size, (unsigned long long)stats.socket_drops);
+
+	if(stats.queue.size)
+		printf("queue            max depth %d/%d dropped %llu\n", stats.queue.max_depth, stats.queue.size, (unsigned long long)stats.queue.dropped);
+
+	for(int c=0;c<config->channels;++c)
+		printf("channel %d ms     queue avg %.3f decode avg %.3f p99 %.3f delivery avg %.3f, %llu incomplete %llu dropped\n", c,
+		channel_stats[c].latency[NHVD_STAGE_QUEUE].avg_ms,
+		channel_stats[c].latency[NHVD_STAGE_DECODE].avg_ms, channel_stats[c].latency[NHVD_STAGE_DECODE].p99_ms,
+		channel_stats[c].latency[NHVD_STAGE_DELIVERY].avg_ms,
+		(unsigned long long)channel_stats[c].incomplete, (unsigned long long)channel_stats[c].dropped);
+}
+
+int compare_double(const void *a, const void *b)
+{
+	const double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+int64_t time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//process CPU time (all threads), the sender only sends pre-encoded data
+double cpu_s()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+int process_user_input(int argc, char **argv, struct bench_config *config)
+{
+	if(argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <hardware> <encoder or raw file> [width] [height] [fps] [video channels] [aux bytes] [frames] [receive queue] [device] [decoder options]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s none libx264\n", argv[0]);
+		fprintf(stderr, "%s none mpeg4 1280 720 60\n", argv[0]);
+		fprintf(stderr, "%s none libx264 640 360 30 2 1000 600 4\n", argv[0]);
+		fprintf(stderr, "%s vaapi libx264 1920 1080 30 1 8 300 0 /dev/dri/renderD128\n", argv[0]);
+		fprintf(stderr, "%s vaapi recorded.h264 848 480 30 1 8 1000 0 /dev/dri/renderD128\n", argv[0]);
+		fprintf(stderr, "%s none recorded.hevc 848 480 30\n", argv[0]);
+		fprintf(stderr, "%s none libx264 1280 720 60 1 8 600 0 \"\" skip_loop_filter=2,threads=2\n", argv[0]);
+		fprintf(stderr, "%s none mpeg4 1280 720 60 1 8 600 0 \"\" lowres=1\n", argv[0]);
+		fprintf(stderr, "%s none libx264 1920 1080 60 1 8 600 4 \"\" receive_buffer_size=8388608,kernel_timestamps,network_cpus=0x2\n", argv[0]);
+
+		return 1;
+	}
+
+	config->hardware = argv[1];
+	config->source = argv[2];
+	config->width = argc > 3 ? atoi(argv[3]) : 640;
+	config->height = argc > 4 ? atoi(argv[4]) : 360;
+	config->fps = argc > 5 ? atoi(argv[5]) : 30;
+	config->channels = argc > 6 ? atoi(argv[6]) : 1;
+	config->aux_size = argc > 7 ? atoi(argv[7]) : 8;
+	config->frames = argc > 8 ? atoi(argv[8]) : 300;
+	config->receive_queue_size = argc > 9 ? atoi(argv[9]) : 0;
+	config->device = argc > 10 ? argv[10] : NULL; //NULL or device, both are ok
+	config->options = argc > 11 ? argv[11] : NULL;
+
+	if(parse_options(config) != 0)
+		return 1;
+
+	if(config->aux_size < (int)sizeof(int64_t))
+		config->aux_size = sizeof(int64_t); //timestamp
+
+	if(config->width <= 0 || config->height <= 0 || config->fps <= 0 || config->channels <= 0 || config->frames <= 0)
+	{
+		fprintf(stderr, "width, height, fps, channels and frames have to be positive\n");
+		return 1;
+	}
+
+	//one more channel carries timestamps
+	if(config->channels > NHVD_MAX_CHANNELS - 1)
+	{
+		fprintf(stderr, "video channels have to be in range 1-%d (NHVD_MAX_CHANNELS with aux channel)\n", NHVD_MAX_CHANNELS - 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+int parse_options(struct bench_config *config)
+{
+	char options[256], *save, *option;
+
+	if(!config->options)
+		return 0;
+
+	snprintf(options, sizeof(options), "%s", config->options);
+
+	for(option = strtok_r(options, ",", &save); option; option = strtok_r(NULL, ",", &save))
+	{
+		const char *value = strchr(option, '=');
+		const int v = value ? atoi(value + 1) : 1;
+		const uint64_t mask = value ? strtoull(value + 1, NULL, 0) : 0;
+
+		if(strncmp(option, "skip_loop_filter", 16) == 0)
+			config->knobs.skip_loop_filter = v;
+		else if(strncmp(option, "skip_nonref", 11) == 0)
+			config->knobs.skip_nonref = v;
+		else if(strncmp(option, "low_delay", 9) == 0)
+			config->knobs.low_delay = v;
+		else if(strncmp(option, "threads", 7) == 0)
+			config->knobs.threads = v;
+		else if(strncmp(option, "lowres", 6) == 0)
+			config->knobs.lowres = v;
+		else if(strncmp(option, "b_frames", 8) == 0)
+			config->b_frames = v;
+		else if(strncmp(option, "decoder_init", 12) == 0)
+			config->tuning.decoder_init = v;
+		else if(strncmp(option, "receive_buffer_size", 19) == 0)
+			config->tuning.receive_buffer_size = v;
+		else if(strncmp(option, "busy_poll_us", 12) == 0)
+			config->tuning.busy_poll_us = v;
+		else if(strncmp(option, "kernel_timestamps", 17) == 0)
+			config->tuning.kernel_timestamps = v;
+		else if(strncmp(option, "network_cpus", 12) == 0)
+			config->tuning.network_cpus = mask;
+		else if(strncmp(option, "decoding_cpus", 13) == 0)
+			config->tuning.decoding_cpus = mask;
+		else if(strncmp(option, "realtime_priority", 17) == 0)
+		{
+			config->tuning.realtime_policy = NHVD_SCHED_FIFO;
+			config->tuning.realtime_priority = v;
+		}
+		else
+		{
+			fprintf(stderr, "unknown decoder option %s\n", option);
+			return 1;
+		}
+	}
+
+	return 0;
+}
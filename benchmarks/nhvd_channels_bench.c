@@ -0,0 +1,177 @@
+/*
+ * NHVD Network Hardware Video Decoder per channel cost benchmark
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This benchmark measures library cost of nhvd_receive_all for given number of channels:
+ * - local MLSP client streams frame sets over loopback
+ * - channels are auxiliary (no decoding) so only library overhead is measured
+ * - receiving thread CPU time (not wall time) is measured per call
+ * - up to NHVD_MAX_CHANNELS channels (MLSP subframes limit, 3)
+ * - too few channels to show scaling, more need MLSP with higher subframes limit
+ *
+ */
+
+#include "../nhvd.h"
+
+// Minimal Latency Streaming Protocol library
+#include "mlsp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h> //usleep
+
+struct sender_config
+{
+	int channels;
+	int frames;
+	int payload;
+};
+
+int bench(int channels, int frames, int payload);
+void *sender_thread(void *arg);
+double thread_cpu_us();
+int process_user_input(int argc, char **argv, int *max_channels, int *frames, int *payload);
+
+//network configuration
+const char *IP=NULL; //listen on any
+const uint16_t PORT=9766;
+const int TIMEOUT_MS=500;
+
+//sender paces the stream so that receiver doesn't drop
+const int SEND_INTERVAL_US=1000;
+
+int main(int argc, char **argv)
+{
+	int max_channels, frames, payload;
+
+	if(process_user_input(argc, argv, &max_channels, &frames, &payload) != 0)
+		return 1;
+
+	printf("channels  frame sets  cpu us/call  cpu us/channel\n");
+
+	for(int c=1;c<=max_channels;++c)
+		if(bench(c, frames, payload) != 0)
+		{
+			fprintf(stderr, "benchmark failed for %d channels\n", c);
+			return 2;
+		}
+
+	return 0;
+}
+
+int bench(int channels, int frames, int payload)
+{
+	struct nhvd_net_config net_config= {IP, PORT, TIMEOUT_MS};
+	struct sender_config sender_config = {channels, frames, payload};
+	struct nhvd_frame *raws;
+	pthread_t sender;
+	double cpu_us = 0;
+	int received = 0, status;
+
+	//no video channels, only auxiliary channels
+	struct nhvd *network_decoder = nhvd_init(&net_config, NULL, 0, channels);
+
+	if(!network_decoder)
+		return 1;
+
+	if( (raws = (struct nhvd_frame*)calloc(channels, sizeof(struct nhvd_frame))) == NULL ||
+		pthread_create(&sender, NULL, sender_thread, &sender_config) != 0)
+	{
+		free(raws);
+		nhvd_close(network_decoder);
+		return 1;
+	}
+
+	while(received < frames)
+	{
+		double start = thread_cpu_us();
+
+		if( (status = nhvd_receive_all(network_decoder, NULL, raws)) == NHVD_ERROR)
+			break;
+
+		cpu_us += thread_cpu_us() - start;
+
+		if(status == NHVD_TIMEOUT)
+			break; //sender finished, some frame sets lost
+
+		++received;
+	}
+
+	pthread_join(sender, NULL);
+
+	if(received)
+		printf("%8d  %10d  %11.2f  %14.2f\n", channels, received,
+		cpu_us / received, cpu_us / received / channels);
+
+	free(raws);
+	nhvd_close(network_decoder);
+
+	return status == NHVD_ERROR;
+}
+
+void *sender_thread(void *arg)
+{
+	const struct sender_config *config = (struct sender_config*)arg;
+	struct mlsp_config mlsp_config = {"127.0.0.1", PORT, 0, config->channels};
+	struct mlsp *streamer = mlsp_init_client(&mlsp_config);
+	uint8_t *data = (uint8_t*)calloc(config->payload, 1);
+
+	for(int f=0;streamer && data && f < config->frames;++f)
+	{
+		for(int c=0;c<config->channels;++c)
+		{
+			struct mlsp_frame frame = {data, config->payload};
+
+			if(mlsp_send(streamer, &frame, c) != MLSP_OK)
+				fprintf(stderr, "failed to send frame\n");
+		}
+
+		usleep(SEND_INTERVAL_US);
+	}
+
+	free(data);
+	mlsp_close(streamer);
+
+	return NULL;
+}
+
+double thread_cpu_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+int process_user_input(int argc, char **argv, int *max_channels, int *frames, int *payload)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <max channels> [frame sets] [payload bytes]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 3\n", argv[0]);
+		fprintf(stderr, "%s 3 1000 4000\n", argv[0]);
+
+		return 1;
+	}
+
+	*max_channels = atoi(argv[1]);
+	*frames = argc > 2 ? atoi(argv[2]) : 1000;
+	*payload = argc > 3 ? atoi(argv[3]) : 1000;
+
+	if(*max_channels < 1 || *max_channels > NHVD_MAX_CHANNELS)
+	{
+		fprintf(stderr, "max channels has to be in range 1-%d (NHVD_MAX_CHANNELS)\n", NHVD_MAX_CHANNELS);
+		return 1;
+	}
+
+	return 0;
+}
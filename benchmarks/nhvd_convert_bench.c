@@ -0,0 +1,213 @@
+/*
+ * NHVD Network Hardware Video Decoder color conversion kernels benchmark
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This benchmark checks and times YUV to RGB row kernels:
+ * - every SIMD kernel supported by CPU is compared with plain C kernel
+ * - all Y, U, V combinations for every coefficient set and RGB/BGR order
+ * - random rows with odd widths and start offsets for the scalar tails
+ * - time per pixel of 1920 wide rows
+ *
+ * Exits with non-zero status if any kernel differs from plain C.
+ *
+ */
+
+//kernels are internal, compiled in directly
+#include "../nhvd_convert.c"
+
+#include <time.h>
+
+struct kernel
+{
+	const char *name;
+	nhvd_yuv_row_fn row;
+	int supported;
+};
+
+struct coeffs
+{
+	const char *name;
+	const struct nhvd_yuv_coeffs *k;
+};
+
+enum { WIDTH = 1920, TAIL_WIDTH = 67 };
+
+uint64_t check_all_values(nhvd_yuv_row_fn row, const struct nhvd_yuv_coeffs *k, int bgr);
+uint64_t check_tails(nhvd_yuv_row_fn row, const struct nhvd_yuv_coeffs *k, int bgr);
+double bench_ns_per_pixel(nhvd_yuv_row_fn row, int rows);
+int64_t time_ns();
+int process_user_input(int argc, char **argv, int *rows);
+
+int main(int argc, char **argv)
+{
+	int rows, failed = 0;
+
+	if(process_user_input(argc, argv, &rows) != 0)
+		return 1;
+
+	const struct coeffs coeffs[] = {
+		{"bt601 limited", &NHVD_BT601_LIMITED}, {"bt601 full", &NHVD_BT601_FULL},
+		{"bt709 limited", &NHVD_BT709_LIMITED}, {"bt709 full", &NHVD_BT709_FULL},
+	};
+
+#ifdef NHVD_X86
+	__builtin_cpu_init();
+
+	const struct kernel kernels[] = {
+		{"c", nhvd_yuv_row_c, 1},
+		{"sse2", nhvd_yuv_row_sse2, __builtin_cpu_supports("sse2")},
+		{"avx2", nhvd_yuv_row_avx2, __builtin_cpu_supports("avx2")},
+	};
+#elif defined(__ARM_NEON)
+	const struct kernel kernels[] = {
+		{"c", nhvd_yuv_row_c, 1},
+		{"neon", nhvd_yuv_row_neon, 1},
+	};
+#else
+	const struct kernel kernels[] = {
+		{"c", nhvd_yuv_row_c, 1},
+	};
+#endif
+
+	const int kernels_size = sizeof(kernels) / sizeof(kernels[0]);
+	const int coeffs_size = sizeof(coeffs) / sizeof(coeffs[0]);
+
+	printf("kernel  mismatches  ns/pixel\n");
+
+	for(int i=0;i<kernels_size;++i)
+	{
+		uint64_t mismatches = 0;
+
+		if(!kernels[i].supported)
+		{
+			printf("%-6s  not supported by CPU\n", kernels[i].name);
+			continue;
+		}
+
+		for(int c=0;i && c<coeffs_size;++c)
+			for(int bgr=0;bgr<2;++bgr)
+			{
+				const uint64_t m = check_all_values(kernels[i].row, coeffs[c].k, bgr) +
+					check_tails(kernels[i].row, coeffs[c].k, bgr);
+
+				if(m)
+					fprintf(stderr, "%s %s %s differs from c in %llu pixels\n",
+					kernels[i].name, coeffs[c].name, bgr ? "bgr" : "rgb", (unsigned long long)m);
+
+				mismatches += m;
+			}
+
+		printf("%-6s  %10llu  %8.3f\n", kernels[i].name, (unsigned long long)mismatches,
+		bench_ns_per_pixel(kernels[i].row, rows));
+
+		failed |= mismatches != 0;
+	}
+
+	return failed;
+}
+
+//every Y with every U, V pair, chroma constant over the row
+uint64_t check_all_values(nhvd_yuv_row_fn row, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	uint8_t y[256], u[128], v[128];
+	uint8_t expected[256 * 4], result[256 * 4];
+	uint64_t mismatches = 0;
+
+	for(int x=0;x<256;++x)
+		y[x] = x;
+
+	for(int cu=0;cu<256;++cu)
+		for(int cv=0;cv<256;++cv)
+		{
+			memset(u, cu, sizeof(u));
+			memset(v, cv, sizeof(v));
+
+			nhvd_yuv_row_c(y, u, v, expected, 0, 256, k, bgr);
+			row(y, u, v, result, 0, 256, k, bgr);
+
+			for(int x=0;x<256;++x)
+				mismatches += memcmp(expected + 4 * x, result + 4 * x, 4) != 0;
+		}
+
+	return mismatches;
+}
+
+//random data, widths and start offsets not multiple of SIMD width
+uint64_t check_tails(nhvd_yuv_row_fn row, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	uint8_t y[TAIL_WIDTH + 1], u[TAIL_WIDTH / 2 + 1], v[TAIL_WIDTH / 2 + 1];
+	uint8_t expected[TAIL_WIDTH * 4], result[TAIL_WIDTH * 4];
+	uint64_t mismatches = 0;
+
+	srand(0);
+
+	for(int width=1;width<=TAIL_WIDTH;++width)
+		for(int x=0;x<width;x+=2)
+		{
+			for(int i=0;i<width;++i)
+				y[i] = rand();
+			for(int i=0;i<(width + 1) / 2;++i)
+				u[i] = rand(), v[i] = rand();
+
+			memset(expected, 0, sizeof(expected));
+			memset(result, 0, sizeof(result));
+
+			nhvd_yuv_row_c(y, u, v, expected, x, width, k, bgr);
+			row(y, u, v, result, x, width, k, bgr);
+
+			for(int i=0;i<width;++i)
+				mismatches += memcmp(expected + 4 * i, result + 4 * i, 4) != 0;
+		}
+
+	return mismatches;
+}
+
+double bench_ns_per_pixel(nhvd_yuv_row_fn row, int rows)
+{
+	static uint8_t y[WIDTH], u[WIDTH / 2], v[WIDTH / 2], dst[WIDTH * 4];
+
+	for(int x=0;x<WIDTH;++x)
+		y[x] = x * 7, u[x / 2] = x * 3, v[x / 2] = x * 5;
+
+	const int64_t start = time_ns();
+
+	for(int r=0;r<rows;++r)
+		row(y, u, v, dst, 0, WIDTH, &NHVD_BT709_LIMITED, r & 1);
+
+	return (time_ns() - start) / ((double)rows * WIDTH);
+}
+
+int64_t time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int process_user_input(int argc, char **argv, int *rows)
+{
+	if(argc > 2)
+	{
+		fprintf(stderr, "Usage: %s [timed rows]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s\n", argv[0]);
+		fprintf(stderr, "%s 100000\n", argv[0]);
+
+		return 1;
+	}
+
+	*rows = argc > 1 ? atoi(argv[1]) : 20000;
+
+	if(*rows <= 0)
+	{
+		fprintf(stderr, "timed rows have to be positive\n");
+		return 1;
+	}
+
+	return 0;
+}
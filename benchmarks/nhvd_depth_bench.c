@@ -0,0 +1,266 @@
+/*
+ * NHVD Network Hardware Video Decoder depth unprojection benchmark
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * This benchmark checks and times nhvd_unproject_depth:
+ * - SIMD row kernel is compared with plain C kernel for odd widths (scalar tails)
+ * - reused point cloud through resolution and texture changes
+ *   (large with texture, small without, small with, large with)
+ * - time per pixel of 1280x720 depth with texture
+ *
+ * Exits with non-zero status if any check fails.
+ * Build with -fsanitize=address to catch point cloud buffer overruns.
+ *
+ */
+
+//kernels are internal, compiled in directly
+#include "../nhvd_depth.c"
+
+#include <math.h>
+#include <time.h>
+
+enum { TAIL_WIDTH = 67, LARGE_WIDTH = 1280, LARGE_HEIGHT = 720, SMALL_WIDTH = 424, SMALL_HEIGHT = 240 };
+
+struct frames
+{
+	AVFrame depth;
+	AVFrame texture;
+	uint16_t *depth_data;
+	uint32_t *texture_data;
+};
+
+uint64_t check_tails(const struct nhvd_depth_config *config);
+uint64_t check_sequence(const struct nhvd_depth_config *config);
+uint64_t check_point_cloud(const struct nhvd_depth_config *config, const struct frames *f,
+	const struct nhvd_point_cloud *pc, int texture);
+int frames_init(struct frames *f, int width, int height, int seed);
+void frames_free(struct frames *f);
+int point_differs(const float a[3], const float b[3]);
+double bench_ns_per_pixel(const struct nhvd_depth_config *config, int frames);
+int64_t time_ns();
+int process_user_input(int argc, char **argv, int *frames);
+
+int main(int argc, char **argv)
+{
+	//D435 like 1280x720 depth with 1 mm units and 0.1-10 m range
+	const struct nhvd_depth_config config = {640.0f, 360.0f, 640.0f, 640.0f, 0.001f, 0.1f, 10.0f};
+	uint64_t tails, sequence;
+	int frames;
+
+	if(process_user_input(argc, argv, &frames) != 0)
+		return 1;
+
+	tails = check_tails(&config);
+	sequence = check_sequence(&config);
+
+	printf("check                 mismatches\n");
+	printf("simd vs c row tails   %10llu\n", (unsigned long long)tails);
+	printf("resolution/texture    %10llu\n", (unsigned long long)sequence);
+	printf("\nns/pixel %.3f\n", bench_ns_per_pixel(&config, frames));
+
+	return tails != 0 || sequence != 0;
+}
+
+//random depth, widths not multiple of SIMD width
+uint64_t check_tails(const struct nhvd_depth_config *config)
+{
+	uint16_t depth[TAIL_WIDTH];
+	float expected[TAIL_WIDTH][3], result[TAIL_WIDTH][3];
+	uint64_t mismatches = 0;
+
+	srand(0);
+
+	for(int width=1;width<=TAIL_WIDTH;++width)
+		for(int row=0;row<LARGE_HEIGHT;row+=LARGE_HEIGHT/8)
+		{
+			for(int i=0;i<width;++i)
+				depth[i] = rand();
+
+			nhvd_unproject_row_c(config, depth, expected, 0, width, (row - config->ppy) / config->fy);
+			nhvd_unproject_row(config, depth, result, width, row);
+
+			for(int i=0;i<width;++i)
+				mismatches += point_differs(expected[i], result[i]);
+		}
+
+	return mismatches;
+}
+
+//point cloud is reused, colors have to be valid for the whole current resolution
+uint64_t check_sequence(const struct nhvd_depth_config *config)
+{
+	struct nhvd_point_cloud pc = {0};
+	struct frames large, small;
+	uint64_t mismatches = 0;
+
+	const struct step
+	{
+		const struct frames *f;
+		int texture;
+	} steps[] = { {&large, 1}, {&small, 0}, {&small, 1}, {&large, 1}, {&small, 0}, {&large, 1} };
+
+	if(frames_init(&large, LARGE_WIDTH, LARGE_HEIGHT, 1) != 0 || frames_init(&small, SMALL_WIDTH, SMALL_HEIGHT, 2) != 0)
+	{
+		fprintf(stderr, "not enough memory for frames\n");
+		exit(1);
+	}
+
+	for(unsigned int i=0;i<sizeof(steps)/sizeof(steps[0]);++i)
+	{
+		const struct frames *f = steps[i].f;
+
+		if(nhvd_unproject_depth(config, &f->depth, steps[i].texture ? &f->texture : NULL, &pc) != NHVD_OK)
+		{
+			fprintf(stderr, "unprojection failed in step %u\n", i);
+			++mismatches;
+			continue;
+		}
+
+		mismatches += check_point_cloud(config, f, &pc, steps[i].texture);
+	}
+
+	nhvd_point_cloud_free(&pc);
+	frames_free(&large);
+	frames_free(&small);
+
+	return mismatches;
+}
+
+uint64_t check_point_cloud(const struct nhvd_depth_config *config, const struct frames *f,
+	const struct nhvd_point_cloud *pc, int texture)
+{
+	const int width = f->depth.width, height = f->depth.height;
+	float expected[LARGE_WIDTH][3];
+	uint64_t mismatches = 0;
+
+	if(pc->used != width * height || pc->size < pc->used || (pc->colors != NULL) != texture)
+		return 1;
+
+	for(int row=0;row<height;++row)
+	{
+		nhvd_unproject_row_c(config, f->depth_data + row * width, expected, 0, width, (row - config->ppy) / config->fy);
+
+		for(int x=0;x<width;++x)
+		{
+			mismatches += point_differs(expected[x], pc->data[row * width + x]);
+
+			if(texture)
+				mismatches += pc->colors[row * width + x] != f->texture_data[row * width + x];
+		}
+	}
+
+	return mismatches;
+}
+
+int frames_init(struct frames *f, int width, int height, int seed)
+{
+	AVFrame zero_frame = {0};
+
+	f->depth_data = (uint16_t*)malloc(width * height * sizeof(uint16_t));
+	f->texture_data = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+
+	if(!f->depth_data || !f->texture_data)
+		return 1;
+
+	srand(seed);
+
+	for(int i=0;i<width * height;++i)
+	{
+		f->depth_data[i] = rand() % 12000; //some out of 0.1-10 m range
+		f->texture_data[i] = (uint32_t)rand() * 2654435761u;
+	}
+
+	f->depth = zero_frame;
+	f->depth.format = AV_PIX_FMT_GRAY16LE;
+	f->depth.width = width;
+	f->depth.height = height;
+	f->depth.data[0] = (uint8_t*)f->depth_data;
+	f->depth.linesize[0] = width * sizeof(uint16_t);
+
+	f->texture = zero_frame;
+	f->texture.format = AV_PIX_FMT_BGR0;
+	f->texture.width = width;
+	f->texture.height = height;
+	f->texture.data[0] = (uint8_t*)f->texture_data;
+	f->texture.linesize[0] = width * sizeof(uint32_t);
+
+	return 0;
+}
+
+void frames_free(struct frames *f)
+{
+	free(f->depth_data);
+	free(f->texture_data);
+}
+
+//SIMD multiplies by reciprocal of focal length, C divides
+int point_differs(const float a[3], const float b[3])
+{
+	for(int i=0;i<3;++i)
+		if(fabsf(a[i] - b[i]) > 1e-5f * (1.0f + fabsf(a[i])))
+			return 1;
+
+	return 0;
+}
+
+double bench_ns_per_pixel(const struct nhvd_depth_config *config, int frames)
+{
+	struct nhvd_point_cloud pc = {0};
+	struct frames f;
+
+	if(frames_init(&f, LARGE_WIDTH, LARGE_HEIGHT, 3) != 0)
+	{
+		fprintf(stderr, "not enough memory for frames\n");
+		exit(1);
+	}
+
+	//the first call allocates
+	nhvd_unproject_depth(config, &f.depth, &f.texture, &pc);
+
+	const int64_t start = time_ns();
+
+	for(int i=0;i<frames;++i)
+		nhvd_unproject_depth(config, &f.depth, &f.texture, &pc);
+
+	const double ns = (time_ns() - start) / ((double)frames * LARGE_WIDTH * LARGE_HEIGHT);
+
+	nhvd_point_cloud_free(&pc);
+	frames_free(&f);
+
+	return ns;
+}
+
+int64_t time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int process_user_input(int argc, char **argv, int *frames)
+{
+	if(argc > 2)
+	{
+		fprintf(stderr, "Usage: %s [timed frames]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s\n", argv[0]);
+		fprintf(stderr, "%s 1000\n", argv[0]);
+
+		return 1;
+	}
+
+	*frames = argc > 1 ? atoi(argv[1]) : 200;
+
+	if(*frames <= 0)
+	{
+		fprintf(stderr, "timed frames have to be positive\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# NHVD Network Hardware Video Decoder decoder options benchmark
+#
+# Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# Runs nhvd-bench software decoding with each nhvd_hw_config knob against baseline.
+# Compare cpu use and decode latency between runs.
+#
+# Usage: nhvd_knobs_bench.sh [nhvd-bench path] [width] [height] [fps] [frames]
+#
+
+BENCH=${1:-./nhvd-bench}
+WIDTH=${2:-1280}
+HEIGHT=${3:-720}
+FPS=${4:-60}
+FRAMES=${5:-600}
+
+run()
+{
+	echo "=== $1 $2"
+	"$BENCH" none "$1" "$WIDTH" "$HEIGHT" "$FPS" 1 8 "$FRAMES" 0 "" "$2" | grep -v "^video channels\|^frames"
+	echo
+}
+
+run libx264 threads=1
+run libx264 threads=1,skip_loop_filter=1
+run libx264 threads=1,skip_loop_filter=2
+run libx264 threads=4
+run libx264 threads=4,low_delay=1
+run libx264 threads=1,b_frames=2
+run libx264 threads=1,b_frames=2,skip_nonref=1
+# h264 and hevc decoders don't support lowres
+run mpeg4 threads=1
+run mpeg4 threads=1,lowres=1
+run mpeg4 threads=1,lowres=2
@@ -0,0 +1,109 @@
+/*
+ * NHVD Network Hardware Video Decoder keyframe requests example
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "../nhvd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void main_loop(struct nhvd *network_decoder);
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config);
+
+//decoder configuration
+const char *HARDWARE=NULL; //input through CLI, e.g. "vaapi"
+const char *CODEC=NULL;  //input through CLI, e.g. "h264"
+const char *DEVICE=NULL; //optionally input through CLI, e.g. "/dev/dri/renderD128"
+const char *PIXEL_FORMAT=NULL; //input through CLI, NULL for default (NV12) or pixel format e.g. "rgb0"
+const int WIDTH=0; //0 to not specify, needed by some codecs
+const int HEIGHT=0; //0 to not specify, needed by some codecs
+const int PROFILE=0; //0 to leave as FF_PROFILE_UNKNOWN
+
+//network configuration
+const char *IP=NULL; //listen on or NULL (listen on any)
+const uint16_t PORT=9766; //to be input through CLI
+const int TIMEOUT_MS=500; //timeout, accept new streaming sequence by receiver
+
+//keyframe requests configuration
+const char *FEEDBACK_IP=NULL; //input through CLI, the sender IP
+const uint16_t FEEDBACK_PORT=9767; //to be input through CLI
+const int FEEDBACK_INTERVAL_MS=0; //0 for default or minimum interval between requests
+
+int main(int argc, char **argv)
+{
+	struct nhvd_hw_config hw_config = {HARDWARE, CODEC, DEVICE, PIXEL_FORMAT, WIDTH, HEIGHT, PROFILE};
+	struct nhvd_net_config net_config = {IP, PORT, TIMEOUT_MS};
+
+	net_config.feedback_ip = FEEDBACK_IP;
+	net_config.feedback_port = FEEDBACK_PORT;
+	net_config.feedback_interval_ms = FEEDBACK_INTERVAL_MS;
+
+	if(process_user_input(argc, argv, &hw_config, &net_config) != 0)
+		return 1;
+
+	struct nhvd *network_decoder = nhvd_init(&net_config, &hw_config, 1, 0);
+
+	if(!network_decoder)
+	{
+		fprintf(stderr, "failed to initalize nhvd\n");
+		return 2;
+	}
+
+	main_loop(network_decoder);
+
+	nhvd_close(network_decoder);
+	return 0;
+}
+
+void main_loop(struct nhvd *network_decoder)
+{
+	AVFrame *frame;
+	struct nhvd_stats stats;
+	struct nhvd_channel_stats channel;
+	int status;
+
+	while( (status = nhvd_receive(network_decoder, &frame)) != NHVD_ERROR )
+	{
+		if(status == NHVD_TIMEOUT || frame == NULL)
+			continue; //keep working
+
+		nhvd_get_stats(network_decoder, &stats, &channel);
+
+		printf("decoded frame %dx%d, reference losses %llu, keyframe requests %llu\n",
+		frame->width, frame->height,
+		(unsigned long long)channel.reference_losses, (unsigned long long)channel.keyframe_requests);
+	}
+
+	fprintf(stderr, "nhvd_receive failed!\n");
+}
+
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config)
+{
+	if(argc < 7)
+	{
+		fprintf(stderr, "Usage: %s <port> <hardware> <codec> <pixel format> <sender ip> <feedback port> [device]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 9766 vaapi h264 bgr0 127.0.0.1 9767\n", argv[0]);
+		fprintf(stderr, "%s 9766 vaapi h264 nv12 192.168.0.100 9767 /dev/dri/renderD128\n", argv[0]);
+		fprintf(stderr, "%s 9766 none h264 yuv420p 127.0.0.1 9767\n", argv[0]);
+
+		return 1;
+	}
+
+	net_config->port = atoi(argv[1]);
+	hw_config->hardware = argv[2];
+	hw_config->codec = argv[3];
+	hw_config->pixel_format = argv[4];
+	net_config->feedback_ip = argv[5];
+	net_config->feedback_port = atoi(argv[6]);
+	hw_config->device = argv[7]; //NULL or device, both are ok
+
+	return 0;
+}
@@ -104,6 +104,7 @@ int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config,
 		fprintf(stderr, "%s 9766 videotoolbox h264 nv12 \n", argv[0]);
 		fprintf(stderr, "%s 9766 vaapi hevc nv12 /dev/dri/renderD128 640 360 1\n", argv[0]);
 		fprintf(stderr, "%s 9766 vaapi hevc p010le /dev/dri/renderD128 848 480 2\n", argv[0]);
+		fprintf(stderr, "%s 9766 none h264 yuv420p \n", argv[0]);
 
 		return 1;
 	}
@@ -0,0 +1,138 @@
+/*
+ * NHVD Network Hardware Video Decoder example
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "../nhvd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+
+void main_loop(struct nhvd *network_decoders[], int streams);
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config, int *streams);
+
+//decoder configuration
+const char *HARDWARE=NULL; //input through CLI, e.g. "vaapi"
+const char *CODEC=NULL;  //input through CLI, e.g. "h264"
+const char *DEVICE=NULL; //optionally input through CLI, e.g. "/dev/dri/renderD128"
+const char *PIXEL_FORMAT=NULL; //input through CLI, NULL for default (NV12) or pixel format e.g. "rgb0"
+const int WIDTH=0; //0 to not specify, needed by some codecs
+const int HEIGHT=0; //0 to not specify, needed by some codecs
+const int PROFILE=0; //0 to leave as FF_PROFILE_UNKNOWN
+
+//network configuration
+const char *IP=NULL; //listen on or NULL (listen on any)
+const uint16_t PORT=9766; //first port, to be input through CLI
+const int TIMEOUT_MS=500; //timeout, accept new streaming sequence by receiver
+const int RECEIVE_QUEUE_SIZE=4; //required for non-blocking receive
+
+const int MAX_STREAMS=64;
+
+int main(int argc, char **argv)
+{
+	struct nhvd_hw_config hw_config= {HARDWARE, CODEC, DEVICE, PIXEL_FORMAT, WIDTH, HEIGHT, PROFILE};
+	struct nhvd_net_config net_config= {IP, PORT, TIMEOUT_MS, RECEIVE_QUEUE_SIZE};
+	struct nhvd *network_decoders[MAX_STREAMS];
+	int streams, status = 0;
+
+	if(process_user_input(argc, argv, &hw_config, &net_config, &streams) != 0)
+		return 1;
+
+	//each stream on its own port, all driven from this thread
+	for(int s=0;s<streams;++s, ++net_config.port)
+		if( (network_decoders[s] = nhvd_init(&net_config, &hw_config, 1, 0)) == NULL)
+		{
+			fprintf(stderr, "failed to initalize nhvd for port %d\n", net_config.port);
+			streams = s;
+			status = 2;
+		}
+
+	if(!status)
+		main_loop(network_decoders, streams);
+
+	for(int s=0;s<streams;++s)
+		nhvd_close(network_decoders[s]);
+
+	return status;
+}
+
+void main_loop(struct nhvd *network_decoders[], int streams)
+{
+	struct pollfd fds[MAX_STREAMS];
+	AVFrame *frame;
+	int status;
+
+	for(int s=0;s<streams;++s)
+	{
+		fds[s].fd = nhvd_get_fd(network_decoders[s]);
+		fds[s].events = POLLIN;
+	}
+
+	while(poll(fds, streams, -1) >= 0)
+		for(int s=0;s<streams;++s)
+		{
+			if(!(fds[s].revents & POLLIN))
+				continue;
+
+			//drain everything that is ready
+			while( (status = nhvd_receive_nonblock(network_decoders[s], &frame, NULL)) != NHVD_WOULD_BLOCK )
+			{
+				if(status == NHVD_ERROR)
+				{
+					fprintf(stderr, "nhvd_receive_nonblock failed!\n");
+					return;
+				}
+
+				if(status == NHVD_TIMEOUT || frame == NULL)
+					continue; //keep working
+
+				printf("stream %d decoded frame %dx%d format %d ls[0] %d ls[1] %d ls[2] %d\n", s,
+				frame->width, frame->height, frame->format,
+				frame->linesize[0], frame->linesize[1], frame->linesize[2]);
+
+				//The AVFrame* is valid until next nhvd_receive_nonblock on this stream
+			}
+		}
+
+	fprintf(stderr, "poll failed!\n");
+}
+
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config, int *streams)
+{
+	if(argc < 6)
+	{
+		fprintf(stderr, "Usage: %s <first port> <streams> <hardware> <codec> <pixel format> [device] [width] [height] [profile]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 9766 2 vaapi h264 bgr0 \n", argv[0]);
+		fprintf(stderr, "%s 9766 4 vaapi h264 nv12 /dev/dri/renderD128\n", argv[0]);
+		fprintf(stderr, "%s 9766 16 none h264 yuv420p \n", argv[0]);
+
+		return 1;
+	}
+
+	net_config->port = atoi(argv[1]);
+	*streams = atoi(argv[2]);
+	hw_config->hardware = argv[3];
+	hw_config->codec = argv[4];
+	hw_config->pixel_format = argv[5];
+	hw_config->device = argv[6]; //NULL or device, both are ok
+
+	if(argc > 7) hw_config->width = atoi(argv[7]);
+	if(argc > 8) hw_config->height = atoi(argv[8]);
+	if(argc > 9) hw_config->profile = atoi(argv[9]);
+
+	if(*streams <= 0 || *streams > MAX_STREAMS)
+	{
+		fprintf(stderr, "streams has to be in range 1-%d\n", MAX_STREAMS);
+		return 1;
+	}
+
+	return 0;
+}
@@ -112,7 +112,7 @@ void main_loop(struct nhvd *network_decoder, FILE *output_file)
 		printf("wrote bytes: %zu\n", written);
 
 		//The nhvd_frame data is valid only until next loop iteration
-		//You should consume immidately or copy
+		//You should consume immidately or reference with nhvd_frame_ref (nhvd_frame_unref)
 	}
 
 	fprintf(stderr, "nhvd_receive failed!\n");
@@ -0,0 +1,242 @@
+/*
+ * NHVD Network Hardware Video Decoder keyframe requests sender
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Reference sender (stand-in for NHVE) answering nhvd keyframe requests:
+ * - synthetic video is encoded with libavcodec software encoder and streamed with MLSP
+ * - keyframes are encoded only on start and on request (no periodic keyframes)
+ * - optionally every N-th frame is not sent to simulate network loss
+ *
+ * Run with nhvd-feedback-example on the receiver side.
+ *
+ */
+
+#include "../nhvd.h"
+
+// Minimal Latency Streaming Protocol library
+#include "mlsp.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+struct sender_config
+{
+	const char *ip; //receiver
+	uint16_t port; //receiver
+	uint16_t feedback_port; //listening for keyframe requests
+	const char *encoder;
+	int loss; //0 or every loss-th frame is not sent
+};
+
+const int WIDTH=640;
+const int HEIGHT=360;
+const int FPS=30;
+
+int process_user_input(int argc, char **argv, struct sender_config *config);
+int feedback_socket(uint16_t port);
+int keyframe_requested(int fd);
+void draw_frame(AVFrame *frame, int f);
+void stream(const struct sender_config *config, AVCodecContext *ctx, struct mlsp *streamer, int fd);
+
+int main(int argc, char **argv)
+{
+	struct sender_config config = {0};
+	const AVCodec *codec;
+	AVCodecContext *ctx = NULL;
+	struct mlsp *streamer = NULL;
+	int fd = -1;
+
+	if(process_user_input(argc, argv, &config) != 0)
+		return 1;
+
+	struct mlsp_config mlsp_config = {config.ip, config.port, 0, 1};
+
+	if( (codec = avcodec_find_encoder_by_name(config.encoder)) == NULL || (ctx = avcodec_alloc_context3(codec)) == NULL)
+	{
+		fprintf(stderr, "failed to find or allocate encoder %s\n", config.encoder);
+		return 2;
+	}
+
+	ctx->width = WIDTH;
+	ctx->height = HEIGHT;
+	ctx->time_base = (AVRational){1, FPS};
+	ctx->framerate = (AVRational){FPS, 1};
+	ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	ctx->gop_size = 1 << 30; //keyframes only on request
+	ctx->max_b_frames = 0;
+	ctx->bit_rate = WIDTH * HEIGHT * FPS / 10;
+
+	av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+	av_opt_set(ctx->priv_data, "forced-idr", "1", 0); //I-frame request encodes IDR
+
+	if(avcodec_open2(ctx, codec, NULL) < 0)
+		fprintf(stderr, "failed to open encoder %s\n", config.encoder);
+	else if( (streamer = mlsp_init_client(&mlsp_config)) == NULL)
+		fprintf(stderr, "failed to initialize network client\n");
+	else if( (fd = feedback_socket(config.feedback_port)) < 0)
+		fprintf(stderr, "failed to listen for keyframe requests on port %d\n", config.feedback_port);
+	else
+		stream(&config, ctx, streamer, fd);
+
+	if(fd >= 0)
+		close(fd);
+
+	mlsp_close(streamer);
+	avcodec_free_context(&ctx);
+
+	return 0;
+}
+
+void stream(const struct sender_config *config, AVCodecContext *ctx, struct mlsp *streamer, int fd)
+{
+	AVFrame *frame = av_frame_alloc();
+	AVPacket *packet = av_packet_alloc();
+	const int64_t interval_ns = 1000000000LL / FPS;
+	struct timespec next;
+
+	if(!frame || !packet)
+		goto cleanup;
+
+	frame->width = ctx->width;
+	frame->height = ctx->height;
+	frame->format = ctx->pix_fmt;
+
+	if(av_frame_get_buffer(frame, 32) < 0)
+		goto cleanup;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for(int f=0;;++f)
+	{
+		if(av_frame_make_writable(frame) < 0)
+			break;
+
+		draw_frame(frame, f);
+		frame->pts = f;
+		frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+		if(keyframe_requested(fd))
+		{
+			frame->pict_type = AV_PICTURE_TYPE_I;
+			printf("frame %d keyframe requested\n", f);
+		}
+
+		if(avcodec_send_frame(ctx, frame) < 0)
+			break;
+
+		while(avcodec_receive_packet(ctx, packet) == 0)
+		{
+			const struct mlsp_frame network_frame = {packet->data, packet->size};
+			const int key = packet->flags & AV_PKT_FLAG_KEY;
+
+			//keyframes are never lost so that the receiver recovers
+			if(config->loss && !key && f % config->loss == 0)
+				printf("frame %d not sent (simulated loss)\n", f);
+			else if(mlsp_send(streamer, &network_frame, 0) != MLSP_OK)
+				fprintf(stderr, "failed to send frame %d\n", f);
+
+			av_packet_unref(packet);
+		}
+
+		next.tv_nsec += interval_ns;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+cleanup:
+	av_packet_free(&packet);
+	av_frame_free(&frame);
+}
+
+int feedback_socket(uint16_t port)
+{
+	struct sockaddr_in address = {0};
+	int fd;
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	if( (fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0)
+		return -1;
+
+	if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+//drain pending requests, non-zero if there was at least one valid
+int keyframe_requested(int fd)
+{
+	struct nhvd_keyframe_request request;
+	int requested = 0;
+
+	while(recv(fd, &request, sizeof(request), 0) == sizeof(request))
+	{
+		if(memcmp(request.magic, NHVD_KEYFRAME_REQUEST_MAGIC, sizeof(request.magic)))
+			continue;
+
+		printf("keyframe request %d for channel %d\n", ntohs(request.sequence), ntohs(request.channel));
+		requested = 1;
+	}
+
+	return requested;
+}
+
+//procedurally generated moving pattern, errors are visible
+void draw_frame(AVFrame *frame, int f)
+{
+	for(int y=0;y < frame->height;++y)
+		for(int x=0;x < frame->width;++x)
+			frame->data[0][y * frame->linesize[0] + x] = x + y + f * 3;
+
+	for(int y=0;y < frame->height / 2;++y)
+		for(int x=0;x < frame->width / 2;++x)
+		{
+			frame->data[1][y * frame->linesize[1] + x] = 128 + y + f * 2;
+			frame->data[2][y * frame->linesize[2] + x] = 64 + x + f * 5;
+		}
+}
+
+int process_user_input(int argc, char **argv, struct sender_config *config)
+{
+	if(argc < 5)
+	{
+		fprintf(stderr, "Usage: %s <ip> <port> <feedback port> <encoder> [loss]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 127.0.0.1 9766 9767 libx264\n", argv[0]);
+		fprintf(stderr, "%s 127.0.0.1 9766 9767 libx264 50\n", argv[0]);
+		fprintf(stderr, "%s 192.168.0.125 9766 9767 libx265 100\n", argv[0]);
+
+		return 1;
+	}
+
+	config->ip = argv[1];
+	config->port = atoi(argv[2]);
+	config->feedback_port = atoi(argv[3]);
+	config->encoder = argv[4];
+
+	if(argc > 5) config->loss = atoi(argv[5]);
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * NHVD Network Hardware Video Decoder example
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "../nhvd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> //pause
+
+void frame_callback(int stream, AVFrame *frames[], struct nhvd_frame *raws, int status, void *user);
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config, int *streams, int *workers);
+
+//decoder configuration
+const char *HARDWARE=NULL; //input through CLI, e.g. "vaapi"
+const char *CODEC=NULL;  //input through CLI, e.g. "h264"
+const char *DEVICE=NULL; //optionally input through CLI, e.g. "/dev/dri/renderD128"
+const char *PIXEL_FORMAT=NULL; //input through CLI, NULL for default (NV12) or pixel format e.g. "rgb0"
+const int WIDTH=0; //0 to not specify, needed by some codecs
+const int HEIGHT=0; //0 to not specify, needed by some codecs
+const int PROFILE=0; //0 to leave as FF_PROFILE_UNKNOWN
+
+//network configuration
+const char *IP=NULL; //listen on or NULL (listen on any)
+const uint16_t PORT=9766; //first port, to be input through CLI
+const int TIMEOUT_MS=500; //timeout, accept new streaming sequence by receiver
+
+int main(int argc, char **argv)
+{
+	struct nhvd_hw_config hw_config= {HARDWARE, CODEC, DEVICE, PIXEL_FORMAT, WIDTH, HEIGHT, PROFILE};
+	struct nhvd_net_config net_config= {IP, PORT, TIMEOUT_MS};
+	int streams, workers;
+
+	if(process_user_input(argc, argv, &hw_config, &net_config, &streams, &workers) != 0)
+		return 1;
+
+	struct nhvd_stream_config stream_config[streams];
+	struct nhvd_server_config server_config = {workers, frame_callback, NULL};
+
+	//each stream on its own port, the first one with higher priority
+	for(int s=0;s<streams;++s, ++net_config.port)
+	{
+		struct nhvd_stream_config stream = {net_config, &hw_config, 1, 0, s == 0};
+		stream_config[s] = stream;
+	}
+
+	struct nhvd_server *server = nhvd_server_init(&server_config, stream_config, streams);
+
+	if(!server)
+	{
+		fprintf(stderr, "failed to initalize nhvd server\n");
+		return 2;
+	}
+
+	//frames are delivered to callback on server threads
+	pause();
+
+	nhvd_server_close(server);
+	return 0;
+}
+
+void frame_callback(int stream, AVFrame *frames[], struct nhvd_frame *raws, int status, void *user)
+{
+	if(status == NHVD_ERROR)
+	{
+		fprintf(stderr, "stream %d failed!\n", stream);
+		return;
+	}
+
+	if(status == NHVD_TIMEOUT || frames[0] == NULL)
+		return; //keep working
+
+	printf("stream %d decoded frame %dx%d format %d ls[0] %d ls[1] %d ls[2] %d\n", stream,
+	frames[0]->width, frames[0]->height, frames[0]->format,
+	frames[0]->linesize[0], frames[0]->linesize[1], frames[0]->linesize[2]);
+
+	//The AVFrame* is valid until callback returns
+}
+
+int process_user_input(int argc, char **argv, struct nhvd_hw_config *hw_config, struct nhvd_net_config *net_config, int *streams, int *workers)
+{
+	if(argc < 6)
+	{
+		fprintf(stderr, "Usage: %s <first port> <streams> <hardware> <codec> <pixel format> [device] [workers]\n\n", argv[0]);
+		fprintf(stderr, "examples: \n");
+		fprintf(stderr, "%s 9766 4 vaapi h264 bgr0 \n", argv[0]);
+		fprintf(stderr, "%s 9766 8 vaapi h264 nv12 /dev/dri/renderD128 2\n", argv[0]);
+		fprintf(stderr, "%s 9766 16 none h264 yuv420p \"\" 4\n", argv[0]);
+
+		return 1;
+	}
+
+	net_config->port = atoi(argv[1]);
+	*streams = atoi(argv[2]);
+	hw_config->hardware = argv[3];
+	hw_config->codec = argv[4];
+	hw_config->pixel_format = argv[5];
+	hw_config->device = argv[6]; //NULL or device, both are ok
+	*workers = argc > 7 ? atoi(argv[7]) : 0;
+
+	if(*streams <= 0)
+	{
+		fprintf(stderr, "streams has to be positive\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -9,30 +9,445 @@
  *
  */
 
+#define _GNU_SOURCE //pthread_setaffinity_np, CPU_SET
+
 #include "nhvd.h"
 
 // Minimal Latency Streaming Protocol library
 #include "mlsp.h"
 // Hardware Video Decoder library
 #include "hvd.h"
+// Color conversion stage
+#include "nhvd_convert.h"
+// SPS parsing
+#include "nhvd_bitstream.h"
+
+#include <libavcodec/avcodec.h>
+
+//channels are MLSP subframes
+_Static_assert((int)NHVD_MAX_CHANNELS == (int)MLSP_MAX_SUBFRAMES, "NHVD_MAX_CHANNELS has to match MLSP_MAX_SUBFRAMES");
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <unistd.h> //sysconf
+#include <fcntl.h> //open
+#include <sys/eventfd.h>
+#include <sys/socket.h> //keyframe requests, socket options
+#include <sys/ioctl.h>
+#include <arpa/inet.h> //inet_pton, htons
+#include <netinet/in.h> //group_req, group_source_req
+#include <net/if.h> //if_nametoindex
+#include <linux/sockios.h> //SIOCGSTAMPNS
+#include <linux/sock_diag.h> //SK_MEMINFO_DROPS
+#include <sched.h>
 
-static int nhvd_decode_frame(struct nhvd *n, struct hvd_packet* packet);
-static struct nhvd *nhvd_close_and_return_null(struct nhvd *n, const char *msg);
-static int NHVD_ERROR_MSG(const char *msg);
+//avoid false sharing between channels decoded by different threads
+#define NHVD_CACHE_LINE 64
+
+struct nhvd_buffer
+{
+	AVBufferRef *ref; //NULL for empty subframe
+	int size;
+};
+
+//single slot of network thread -> decoding thread queue
+struct nhvd_queue_entry
+{
+	int status; //NHVD_OK (frame set) or NHVD_TIMEOUT
+	int64_t received_ns; //frame set reassembled
+	struct nhvd_buffer *buffer; //hardware_decoders_size + auxiliary_channels_size
+};
+
+//bounded lock-free single producer single consumer queue
+struct nhvd_queue
+{
+	struct nhvd_queue_entry *entry;
+	unsigned int size; //receive_queue_size + 1 entry held by consumer
+
+	AVBufferPool **pool; //per channel, used by network thread
+	int *pool_size;
+
+	atomic_uint head; //next entry to write, only network thread stores
+	atomic_uint tail; //next entry to read, only decoding thread stores
+	int held; //decoding thread holds entries at tail until next receive
+	sem_t ready;
+	int ready_initialized;
+	int event_fd; //-1 or readable while entries are waiting, for poll/epoll
+
+	int max_depth; //updated by decoding thread
+	uint64_t skipped; //updated by decoding thread
+	atomic_uint_least64_t received;
+	atomic_uint_least64_t dropped;
+};
+
+//libavcodec software decoder with the same semantics as hvd
+struct nhvd_sw_decoder
+{
+	AVCodecContext *decoder_ctx;
+	enum AVDiscard skip_frame; //configured, stale frame sets are decoded with AVDISCARD_NONREF
+	AVFrame *frame;
+	AVPacket *packet;
+};
+
+enum nhvd_codec_enum
+{
+	NHVD_CODEC_OTHER,
+	NHVD_CODEC_H264,
+	NHVD_CODEC_HEVC,
+	NHVD_CODEC_VP8,
+};
+
+//per video channel decoding state
+struct nhvd_channel
+{
+	alignas(NHVD_CACHE_LINE) struct hvd *hardware_decoder;
+	struct nhvd_sw_decoder *software_decoder;
+	struct nhvd_converter *converter; //NULL without output_format
+	AVFrame *frame;
+
+	struct nhvd_hw_config config; //copy with owned strings, decoder is created from it
+	int threads; //software decoding
+	struct nhvd_sps sps; //the last seen stream parameters
+	int sps_valid;
+	int codec; //nhvd_codec_enum
+	int skip_nonref; //drop non-reference H.264/HEVC packets before decoding
+	int wait_keyframe;
+	int flush_pending; //NHVD_TIMEOUT_LAZY, flush if stream restarts
+	int frame_num; //-1 or frame_num of the last H.264 reference frame
+	int keyframe_needed; //references lost, request keyframe until it arrives
+	int64_t keyframe_request_ns; //0 or the last keyframe request
+	atomic_int paused; //set by the user from any thread
+	int decoding_paused; //paused as last seen by decoding thread
+
+	int64_t send_ns; //data sent to decoder
+	int64_t decoded_ns; //frame received from decoder
+};
+
+enum { NHVD_HISTOGRAM_BUCKETS = 92 }; //up to ~16.7 s
+
+struct nhvd_histogram
+{
+	uint64_t count;
+	uint64_t sum_us;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint32_t bucket[NHVD_HISTOGRAM_BUCKETS];
+};
+
+//per channel statistics, updated by decoding thread
+struct nhvd_channel_counters
+{
+	uint64_t received;
+	uint64_t decoded;
+	uint64_t dropped;
+	uint64_t incomplete;
+	uint64_t paused;
+	uint64_t reconfigured;
+	uint64_t reference_losses;
+	uint64_t keyframe_requests;
+	uint64_t bytes;
+	int64_t first_frame_ns; //0 or the first decoded frame handed to the user
+	uint64_t reported_bytes; //at previous nhvd_get_stats
+
+	struct nhvd_histogram latency[NHVD_STAGES];
+};
+
+//drives single hardware decoder in parallel decoding
+struct nhvd_decoder_worker
+{
+	alignas(NHVD_CACHE_LINE) struct nhvd *n;
+	int channel;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t work; //signalled by decoding thread when job is ready
+	pthread_cond_t done; //signalled by worker when job is finished
+	int initialized;
+	int running;
+
+	int keep_working;
+	int job;
+	struct nhvd_frame *packet; //NULL to flush
+	int convert; //0 for frames that are not returned
+	int status;
+};
+
+//decoded frame handed to the user in callbacks
+struct nhvd_pooled_frame
+{
+	AVFrame *frame;
+	atomic_int in_use; //set by delivery thread, cleared by nhvd_frame_release
+};
+
+//push mode, library thread receives and calls user callbacks
+struct nhvd_delivery
+{
+	struct nhvd_callback_config config;
+
+	struct nhvd_pooled_frame *pool; //frame_pool_size
+	int pool_size;
+	atomic_uint_least64_t pool_exhausted; //read by nhvd_get_stats from any thread
+
+	AVFrame **frames; //hardware_decoders_size, returned by receive
+	AVFrame **pooled; //hardware_decoders_size, passed to callback
+	struct nhvd_frame *raws; //hardware_decoders_size + auxiliary_channels_size
+
+	pthread_t thread;
+	int thread_running;
+	atomic_int keep_working;
+};
+
+//capture file format, host byte order:
+//- nhvd_capture_header
+//- records of nhvd_capture_record, uint32_t size[channels] and data of all channels
+//record headers allow skipping through the file without reading the data
+#define NHVD_CAPTURE_MAGIC "NHVDCAP1"
+enum { NHVD_CAPTURE_RECORD_MAGIC = 0x5253484E }; //"NHSR"
+enum { NHVD_FRAME_POOL_SIZE = 4 }; //default frame_pool_size per video channel
+enum { NHVD_CAPTURE_QUEUE_SIZE = 64 }; //default capture_queue_size
+enum { NHVD_CAPTURE_BUFFER = 1 << 22 }; //staging buffer of capture writes
+enum { NHVD_CAPTURE_ALIGN = 4096 }; //capture writes are multiple of this
+
+struct nhvd_capture_header
+{
+	char magic[8];
+	uint32_t channels;
+	uint32_t reserved;
+};
+
+struct nhvd_capture_record
+{
+	uint32_t magic;
+	uint32_t channels;
+	int64_t received_ns; //frame set reassembled, CLOCK_MONOTONIC
+};
+
+//frame set waiting for writing, references received data
+struct nhvd_recorder_slot
+{
+	int64_t received_ns;
+	struct nhvd_frame *frame; //channels
+};
+
+//bounded single producer (receiving thread) single consumer (I/O thread) queue
+struct nhvd_recorder
+{
+	int fd;
+	int channels;
+
+	struct nhvd_recorder_slot *slot;
+	unsigned int size;
+	AVBufferPool **pool; //per channel, for data that is not reference counted
+	int *pool_size;
+	atomic_uint head; //next slot to write, only receiving thread stores
+	atomic_uint tail; //next slot to record, only I/O thread stores
+	sem_t ready;
+	int ready_initialized;
+
+	pthread_t thread;
+	int thread_running;
+	atomic_int keep_working;
+	atomic_int error;
+
+	uint8_t *buffer; //NHVD_CAPTURE_BUFFER, NHVD_CAPTURE_ALIGN aligned
+	size_t used;
+
+	atomic_int max_depth;
+	atomic_uint_least64_t recorded;
+	atomic_uint_least64_t dropped;
+	atomic_uint_least64_t bytes;
+};
+
+//capture file replayed instead of network
+struct nhvd_replay
+{
+	FILE *file;
+	int timing; //replay with original timing
+	int pending; //record read but not yet returned
+
+	struct nhvd_capture_record record;
+	uint32_t *size; //channels
+	struct mlsp_frame *frame; //channels, pointing to data
+	uint8_t *data;
+	size_t data_size;
+
+	int64_t first_ns; //received_ns of the first record
+	int64_t start_ns; //replay of the first record
+};
+
+//adaptive playout of queued frame sets, state owned by decoding thread
+struct nhvd_jitter
+{
+	int64_t max_ns; //0 if disabled, hard cap of added latency
+	int64_t previous_ns; //0 or arrival of previous frame set
+	int64_t release_ns; //release of previous frame set
+	int64_t interval_ns; //smoothed inter-arrival interval
+	int64_t jitter_ns; //smoothed inter-arrival deviation from interval
+	int64_t target_ns; //current buffer depth
+};
 
 struct nhvd
 {
 	struct mlsp *network_streamer;
+	struct nhvd_replay replay; //file NULL when receiving from network
+	struct nhvd_recorder *recorder; //NULL or recording received frame sets
+	struct nhvd_frame *capture_frame; //network thread frame set dropped from queue
 
-	struct hvd *hardware_decoder[NHVD_MAX_DECODERS];
+	struct nhvd_channel *channel; //hardware_decoders_size
 	int hardware_decoders_size;
 	int auxiliary_channels_size;
+	int timeout_ms;
+	int max_backlog;
+	int backlog_policy;
+	int timeout_policy;
+	struct nhvd_jitter jitter;
+
+	int feedback_fd; //-1 or socket for keyframe requests
+	struct sockaddr_storage feedback_address; //the sender listening for keyframe requests, IPv4 or IPv6
+	socklen_t feedback_address_size;
+	int64_t feedback_interval_ns;
+	uint16_t feedback_sequence;
+
+	int socket_fd; //-1 or network socket, created by the library and used by MLSP (NHVD_MLSP_SOCKET)
+	int kernel_timestamps;
+	uint64_t network_cpus;
+	uint64_t decoding_cpus;
+	int realtime_policy;
+	int realtime_priority;
+
+	struct nhvd_frame *packet; //hardware_decoders_size
+	struct nhvd_frame *raw; //currently processed frame set
+	int64_t received_ns; //currently processed frame set reassembled
+
+	struct nhvd_channel_counters *counters; //hardware_decoders_size + auxiliary_channels_size
+	uint64_t timeouts;
+	uint64_t flushes;
+	int64_t stats_time_ns; //previous nhvd_get_stats
+	int64_t init_ns; //nhvd_init called
+	int64_t ready_ns; //nhvd_init finished
+	int64_t first_frame_ns; //0 or the first decoded frame handed to the user
+
+	AVFrame **batch_frame; //references to decoded frames returned in batch
+	int batch_frames_size;
+	AVBufferRef **batch_raw; //references to raw data returned in batch, queue entries are released early
+	int batch_raws_size;
 
-	AVFrame *frame[NHVD_MAX_DECODERS];
+	struct nhvd_queue queue;
+	pthread_t network_thread;
+	int network_thread_running;
+	atomic_int keep_working;
+	atomic_int network_error;
+
+	struct nhvd_decoder_worker *decoder_worker; //hardware_decoders_size, channel 0 decoded by caller
+
+	struct nhvd_delivery delivery; //thread not running in pull mode
 };
 
+//internal, returned when waiting for frame set is not allowed
+enum { NHVD_QUEUE_EMPTY = -100 };
+//internal, lazily initialized channel waits for parameter sets
+enum { NHVD_NO_SPS = -101 };
+enum { NHVD_FEEDBACK_INTERVAL_MS = 100 }; //default feedback_interval_ms
+
+static int nhvd_receive_set(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws, int wait);
+static int nhvd_batch_frames_alloc(struct nhvd *n, int size);
+static int nhvd_batch_raws_alloc(struct nhvd *n, int size);
+static int nhvd_receive_frame_set(struct nhvd *n);
+static int nhvd_source_receive(struct nhvd *n, const struct mlsp_frame **frame);
+static void *nhvd_delivery_thread(void *arg);
+static AVFrame *nhvd_pool_acquire(struct nhvd_delivery *d, AVFrame *frame);
+static void nhvd_delivery_close(struct nhvd *n);
+static struct nhvd_recorder *nhvd_recorder_init(const char *file, int size, int channels);
+static void nhvd_recorder_close(struct nhvd_recorder *r);
+static struct nhvd_recorder *nhvd_recorder_close_and_return_null(struct nhvd_recorder *r, const char *msg);
+static void nhvd_recorder_push(struct nhvd_recorder *r, const struct nhvd_frame *frame, int64_t received_ns);
+static int nhvd_recorder_ref(struct nhvd_recorder *r, int channel, struct nhvd_frame *dst, const struct nhvd_frame *src);
+static void *nhvd_recorder_thread(void *arg);
+static int nhvd_recorder_write_slot(struct nhvd_recorder *r, struct nhvd_recorder_slot *slot);
+static int nhvd_recorder_append(struct nhvd_recorder *r, const void *data, size_t size);
+static int nhvd_recorder_flush(struct nhvd_recorder *r, int all);
+static int nhvd_replay_init(struct nhvd_replay *r, const char *file, int timing, int channels);
+static void nhvd_replay_close(struct nhvd_replay *r);
+static int nhvd_replay_receive(struct nhvd *n, const struct mlsp_frame **frame);
+static int nhvd_replay_read(struct nhvd_replay *r, int channels);
+static int nhvd_receive_frame_set_queued(struct nhvd *n, int wait);
+static int nhvd_queue_wait(struct nhvd *n, int wait);
+static void nhvd_queue_release(struct nhvd_queue *q);
+static int nhvd_shed_backlog(struct nhvd *n, unsigned int *tail, unsigned int head);
+static int nhvd_decode_stale(struct nhvd *n, const struct nhvd_queue_entry *entry);
+static int nhvd_timeout(struct nhvd *n);
+static void nhvd_jitter_wait(struct nhvd_jitter *j, int64_t received_ns);
+static void nhvd_flush_pending(struct nhvd *n, int channel);
+static void nhvd_wait_keyframe(struct nhvd *n, int channel);
+static int nhvd_channel_paused(struct nhvd *n, int channel);
+static int nhvd_feedback_init(struct nhvd *n, const struct nhvd_net_config *net_config);
+#ifdef NHVD_MLSP_SOCKET
+static int nhvd_socket_init(struct nhvd *n, const struct nhvd_net_config *net_config);
+static int nhvd_multicast_join(struct nhvd *n, const struct nhvd_net_config *net_config);
+#endif
+static int nhvd_address_parse(const char *ip, struct sockaddr_storage *address);
+static int64_t nhvd_received_ns(struct nhvd *n);
+static int nhvd_thread_tune(struct nhvd *n, pthread_t thread, uint64_t cpus);
+static void nhvd_track_references(struct nhvd *n, int channel);
+static void nhvd_reference_lost(struct nhvd *n, int channel);
+static void nhvd_request_keyframes(struct nhvd *n);
+static void nhvd_request_keyframe(struct nhvd *n, int channel);
+static int nhvd_is_keyframe_set(struct nhvd *n, const struct nhvd_queue_entry *entry);
+static int nhvd_codec(const char *codec);
+static int nhvd_is_keyframe(int codec, const uint8_t *data, int size);
+static int nhvd_is_reference(int codec, const uint8_t *data, int size);
+static const uint8_t *nhvd_first_vcl(int codec, const uint8_t *data, int size);
+static int nhvd_decode_frame(struct nhvd *n, struct nhvd_frame* packet, int convert);
+static void nhvd_stats_update(struct nhvd *n);
+static void nhvd_stats_drop(struct nhvd *n, const struct nhvd_queue_entry *entry);
+static int64_t nhvd_time_ns(void);
+static int nhvd_histogram_bucket(uint32_t us);
+static uint32_t nhvd_histogram_bucket_end(int bucket);
+static void nhvd_histogram_add(struct nhvd_histogram *h, int64_t ns);
+static void nhvd_histogram_stats(const struct nhvd_histogram *h, struct nhvd_latency_stats *stats);
+static int nhvd_send_packet(struct nhvd *n, int channel, struct nhvd_frame *packet);
+static AVFrame *nhvd_receive_frame(struct nhvd *n, int channel, int *error);
+static int nhvd_is_software(const char *hardware);
+static int nhvd_config_copy(struct nhvd_hw_config *dst, const struct nhvd_hw_config *src);
+static void nhvd_config_free(struct nhvd_hw_config *config);
+static int nhvd_decoder_init(struct nhvd_channel *c);
+static int nhvd_decoders_init_parallel(struct nhvd *n);
+static void *nhvd_decoder_init_thread(void *arg);
+static int nhvd_channel_configure(struct nhvd *n, int channel);
+static int nhvd_decoder_rebuild(struct nhvd *n, int channel);
+static int nhvd_software_threads(const struct nhvd_net_config *net_config,
+	const struct nhvd_hw_config *hw_config, int hw_size, int channel);
+static struct nhvd_sw_decoder *nhvd_sw_init(const struct nhvd_hw_config *config, int threads);
+static void nhvd_sw_close(struct nhvd_sw_decoder *s);
+static struct nhvd_sw_decoder *nhvd_sw_close_and_return_null(struct nhvd_sw_decoder *s, const char *msg);
+static int nhvd_sw_send_packet(struct nhvd_sw_decoder *s, struct nhvd_frame *packet);
+static AVFrame *nhvd_sw_receive_frame(struct nhvd_sw_decoder *s, int *error);
+static int nhvd_decode_frame_parallel(struct nhvd *n, struct nhvd_frame *packet, int convert);
+static int nhvd_decode_channel(struct nhvd *n, int channel, struct nhvd_frame *packet, int convert);
+static int nhvd_convert_frame(struct nhvd *n, int channel);
+static int nhvd_decoder_workers_init(struct nhvd *n);
+static void nhvd_decoder_workers_close(struct nhvd *n);
+static void *nhvd_decoder_thread(void *arg);
+static int nhvd_queue_init(struct nhvd_queue *q, int size, int channels);
+static void nhvd_queue_close(struct nhvd_queue *q, int channels);
+static int nhvd_queue_push(struct nhvd_queue *q, const struct mlsp_frame *frame, int channels, int status, int64_t received_ns);
+static int nhvd_queue_full(struct nhvd_queue *q);
+static void nhvd_queue_signal(struct nhvd_queue *q);
+static void nhvd_capture_dropped(struct nhvd *n, const struct mlsp_frame *frame);
+static AVBufferRef *nhvd_pool_buffer(AVBufferPool **pool, int *pool_size, int size);
+static void nhvd_buffer_frame(const struct nhvd_buffer *buffer, struct nhvd_frame *frame);
+static void *nhvd_network_thread(void *arg);
+static void *nhvd_aligned_calloc(size_t nmemb, size_t size);
+static struct nhvd *nhvd_close_and_return_null(struct nhvd *n, const char *msg);
+static int NHVD_ERROR_MSG(const char *msg);
+
 struct nhvd *nhvd_init(
 	const struct nhvd_net_config *net_config,
 	const struct nhvd_hw_config *hw_config, int hw_size, int aux_size)
@@ -40,29 +455,171 @@ struct nhvd *nhvd_init(
 	struct nhvd *n, zero_nhvd = {0};
 	struct mlsp_config mlsp_cfg={net_config->ip, net_config->port, net_config->timeout_ms, hw_size + aux_size};
 
-	if(hw_size > NHVD_MAX_DECODERS)
-		return nhvd_close_and_return_null(NULL, "the maximum number of decoders (compile time) exceeded");
+	if(hw_size < 0 || aux_size < 0)
+		return nhvd_close_and_return_null(NULL, "hw_size and aux_size have to be 0 or positive");
+
+	if(hw_size + aux_size > NHVD_MAX_CHANNELS)
+		return nhvd_close_and_return_null(NULL, "hw_size + aux_size exceeds NHVD_MAX_CHANNELS");
+
+	if(net_config->receive_queue_size < 0)
+		return nhvd_close_and_return_null(NULL, "receive_queue_size has to be 0 or positive");
+
+	if(net_config->receive_queue_size && net_config->timeout_ms <= 0)
+		return nhvd_close_and_return_null(NULL, "network receive thread requires positive timeout_ms");
+
+	if(net_config->max_backlog && !net_config->receive_queue_size)
+		return nhvd_close_and_return_null(NULL, "max_backlog requires receive_queue_size");
+
+	if(net_config->jitter_buffer_ms < 0)
+		return nhvd_close_and_return_null(NULL, "jitter_buffer_ms has to be 0 or positive");
+
+	if(net_config->jitter_buffer_ms && !net_config->receive_queue_size)
+		return nhvd_close_and_return_null(NULL, "jitter_buffer_ms requires receive_queue_size");
+
+	if(net_config->decoder_init < NHVD_INIT_SEQUENTIAL || net_config->decoder_init > NHVD_INIT_LAZY)
+		return nhvd_close_and_return_null(NULL, "decoder_init has to be NHVD_INIT_SEQUENTIAL, NHVD_INIT_PARALLEL or NHVD_INIT_LAZY");
+
+	if(net_config->feedback_ip && !net_config->feedback_port)
+		return nhvd_close_and_return_null(NULL, "feedback_ip requires feedback_port");
+
+	if(net_config->feedback_interval_ms < 0)
+		return nhvd_close_and_return_null(NULL, "feedback_interval_ms has to be 0 or positive");
+
+	if(net_config->receive_buffer_size < 0 || net_config->busy_poll_us < 0)
+		return nhvd_close_and_return_null(NULL, "receive_buffer_size and busy_poll_us have to be 0 or positive");
+
+	if(net_config->realtime_policy < NHVD_SCHED_OTHER || net_config->realtime_policy > NHVD_SCHED_RR)
+		return nhvd_close_and_return_null(NULL, "realtime_policy has to be NHVD_SCHED_OTHER, NHVD_SCHED_FIFO or NHVD_SCHED_RR");
+
+	if(net_config->multicast_group && net_config->ip)
+		return nhvd_close_and_return_null(NULL, "multicast_group requires NULL ip (see multicast_interface)");
+
+	if(!net_config->multicast_group && (net_config->multicast_source || net_config->multicast_interface))
+		return nhvd_close_and_return_null(NULL, "multicast_source and multicast_interface require multicast_group");
+
+#ifndef NHVD_MLSP_SOCKET
+	//MLSP creates its own socket, the library has no access to it
+	if(!net_config->replay_file && (net_config->receive_buffer_size || net_config->busy_poll_us ||
+		net_config->kernel_timestamps || net_config->multicast_group))
+		return nhvd_close_and_return_null(NULL, "receive_buffer_size, busy_poll_us, kernel_timestamps and multicast_group require build with NHVD_MLSP_SOCKET");
+#endif
+
+	if(net_config->realtime_policy != NHVD_SCHED_OTHER &&
+		(net_config->realtime_priority < 1 || net_config->realtime_priority > 99))
+		return nhvd_close_and_return_null(NULL, "realtime_priority has to be in range 1-99");
 
 	if( ( n = (struct nhvd*)malloc(sizeof(struct nhvd))) == NULL )
 		return nhvd_close_and_return_null(NULL, "not enough memory for nhvd");
 
 	*n = zero_nhvd;
-
-	if( (n->network_streamer = mlsp_init_server(&mlsp_cfg)) == NULL )
-		return nhvd_close_and_return_null(n, "failed to initialize network server");
+	n->queue.event_fd = -1;
+	n->feedback_fd = -1;
+	n->socket_fd = -1;
+	n->init_ns = nhvd_time_ns();
 
 	n->hardware_decoders_size = hw_size;
 	n->auxiliary_channels_size = aux_size;
+	n->timeout_ms = net_config->timeout_ms;
+	n->max_backlog = net_config->max_backlog;
+	n->backlog_policy = net_config->backlog_policy;
+	n->timeout_policy = net_config->timeout_policy;
+	n->jitter.max_ns = net_config->jitter_buffer_ms * 1000000LL;
+	n->network_cpus = net_config->network_cpus;
+	n->decoding_cpus = net_config->decoding_cpus;
+	n->realtime_policy = net_config->realtime_policy;
+	n->realtime_priority = net_config->realtime_priority;
+
+	if( (n->raw = (struct nhvd_frame*)calloc(hw_size + aux_size, sizeof(struct nhvd_frame))) == NULL ||
+		(n->packet = (struct nhvd_frame*)calloc(hw_size, sizeof(struct nhvd_frame))) == NULL ||
+		(n->channel = (struct nhvd_channel*)nhvd_aligned_calloc(hw_size, sizeof(struct nhvd_channel))) == NULL ||
+		(n->counters = (struct nhvd_channel_counters*)calloc(hw_size + aux_size, sizeof(struct nhvd_channel_counters))) == NULL)
+		return nhvd_close_and_return_null(n, "not enough memory for channels");
+
+	n->stats_time_ns = nhvd_time_ns();
+
+	if(net_config->capture_queue_size < 0)
+		return nhvd_close_and_return_null(n, "capture_queue_size has to be 0 or positive");
+
+	if(net_config->capture_file)
+	{
+		const int size = net_config->capture_queue_size ? net_config->capture_queue_size : NHVD_CAPTURE_QUEUE_SIZE;
+
+		if( (n->capture_frame = (struct nhvd_frame*)calloc(hw_size + aux_size, sizeof(struct nhvd_frame))) == NULL)
+			return nhvd_close_and_return_null(n, "not enough memory for capture");
+
+		if( (n->recorder = nhvd_recorder_init(net_config->capture_file, size, hw_size + aux_size)) == NULL )
+			return nhvd_close_and_return_null(n, "failed to initialize capture");
+	}
+
+	if(net_config->replay_file)
+	{
+		if(nhvd_replay_init(&n->replay, net_config->replay_file, net_config->replay_timing, hw_size + aux_size) != NHVD_OK)
+			return nhvd_close_and_return_null(n, "failed to initialize replay");
+	}
+#ifdef NHVD_MLSP_SOCKET
+	else if(nhvd_socket_init(n, net_config) != NHVD_OK)
+		return nhvd_close_and_return_null(n, NULL);
+	else if( (n->network_streamer = mlsp_init_server_socket(&mlsp_cfg, n->socket_fd)) == NULL )
+		return nhvd_close_and_return_null(n, "failed to initialize network server");
+#else
+	else if( (n->network_streamer = mlsp_init_server(&mlsp_cfg)) == NULL )
+		return nhvd_close_and_return_null(n, "failed to initialize network server");
+#endif
+
+	if(net_config->feedback_ip)
+		if(nhvd_feedback_init(n, net_config) != NHVD_OK)
+			return nhvd_close_and_return_null(n, NULL);
 
 	for(int i=0;i<hw_size;++i)
 	{
-		struct hvd_config hvd_cfg={hw_config[i].hardware, hw_config[i].codec, hw_config[i].device,
-		hw_config[i].pixel_format, hw_config[i].width, hw_config[i].height, hw_config[i].profile};
+		struct nhvd_channel *c = &n->channel[i];
+
+		if(nhvd_config_copy(&c->config, &hw_config[i]) != NHVD_OK)
+			return nhvd_close_and_return_null(n, "not enough memory for channel configuration");
+
+		c->codec = nhvd_codec(hw_config[i].codec);
+		c->skip_nonref = hw_config[i].skip_nonref;
+		c->frame_num = -1;
+
+		if(nhvd_is_software(hw_config[i].hardware))
+			c->threads = nhvd_software_threads(net_config, hw_config, hw_size, i);
 
-		if( (n->hardware_decoder[i] = hvd_init(&hvd_cfg)) == NULL )
-			return nhvd_close_and_return_null(n, "failed to initalize hardware decoder");
+		if(hw_config[i].output_format && hw_config[i].output_format[0])
+			if( (c->converter = nhvd_converter_init(hw_config[i].output_format)) == NULL )
+				return nhvd_close_and_return_null(n, "failed to initialize color conversion");
+
+		if(net_config->decoder_init == NHVD_INIT_SEQUENTIAL)
+			if(nhvd_decoder_init(c) != NHVD_OK)
+				return nhvd_close_and_return_null(n, NULL);
 	}
 
+	//device open and codec setup of channels overlap in time
+	if(net_config->decoder_init == NHVD_INIT_PARALLEL && hw_size)
+		if(nhvd_decoders_init_parallel(n) != NHVD_OK)
+			return nhvd_close_and_return_null(n, NULL);
+
+	if(net_config->parallel_decoding && hw_size > 1)
+		if(nhvd_decoder_workers_init(n) != NHVD_OK)
+			return nhvd_close_and_return_null(n, "failed to initialize parallel decoding");
+
+	n->ready_ns = nhvd_time_ns();
+
+	if(!net_config->receive_queue_size)
+		return n;
+
+	if(nhvd_queue_init(&n->queue, net_config->receive_queue_size, hw_size + aux_size) != NHVD_OK)
+		return nhvd_close_and_return_null(n, "failed to initialize receive queue");
+
+	atomic_store(&n->keep_working, 1);
+
+	if(pthread_create(&n->network_thread, NULL, nhvd_network_thread, n) != 0)
+		return nhvd_close_and_return_null(n, "failed to create network receive thread");
+
+	n->network_thread_running = 1;
+
+	if(nhvd_thread_tune(n, n->network_thread, n->network_cpus) != NHVD_OK)
+		return nhvd_close_and_return_null(n, NULL);
+
 	return n;
 }
 
@@ -71,11 +628,52 @@ void nhvd_close(struct nhvd *n)
 	if(n == NULL)
 		return;
 
+	//delivery thread receives, stop it first
+	nhvd_delivery_close(n);
+
+	if(n->network_thread_running)
+	{
+		atomic_store(&n->keep_working, 0);
+		pthread_join(n->network_thread, NULL);
+	}
+
+	nhvd_queue_close(&n->queue, n->hardware_decoders_size + n->auxiliary_channels_size);
+
 	mlsp_close(n->network_streamer);
+	nhvd_replay_close(&n->replay);
 
-	for(int i=0;i<n->hardware_decoders_size;++i)
-		hvd_close(n->hardware_decoder[i]);
+	//MLSP doesn't close socket it was given
+	if(n->socket_fd >= 0)
+		close(n->socket_fd);
+	nhvd_recorder_close(n->recorder);
+
+	if(n->feedback_fd >= 0)
+		close(n->feedback_fd);
+
+	nhvd_decoder_workers_close(n);
+
+	for(int i=0;n->channel && i<n->hardware_decoders_size;++i)
+	{
+		hvd_close(n->channel[i].hardware_decoder);
+		nhvd_sw_close(n->channel[i].software_decoder);
+		nhvd_converter_close(n->channel[i].converter);
+		nhvd_config_free(&n->channel[i].config);
+	}
+
+	free(n->channel);
+	for(int i=0;i<n->batch_frames_size;++i)
+		av_frame_free(&n->batch_frame[i]);
+
+	free(n->batch_frame);
+
+	for(int i=0;i<n->batch_raws_size;++i)
+		av_buffer_unref(&n->batch_raw[i]);
 
+	free(n->batch_raw);
+	free(n->counters);
+	free(n->capture_frame);
+	free(n->packet);
+	free(n->raw);
 	free(n);
 }
 
@@ -86,85 +684,2576 @@ int nhvd_receive(struct nhvd *n, AVFrame *frames[])
 
 int nhvd_receive_all(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws)
 {
-	struct hvd_packet packets[NHVD_MAX_DECODERS] = {0};
-	const struct mlsp_frame *streamer_frame;
-	int error;
+	if(n->network_thread_running)
+		nhvd_queue_release(&n->queue);
+
+	return nhvd_receive_set(n, frames, raws, 1);
+}
+
+int nhvd_receive_nonblock(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws)
+{
+	uint64_t events;
+	int status;
+
+	if(!n->network_thread_running)
+		return NHVD_ERROR_MSG("non-blocking receive requires receive_queue_size");
+
+	nhvd_queue_release(&n->queue);
+
+	if( (status = nhvd_receive_set(n, frames, raws, 0)) != NHVD_QUEUE_EMPTY)
+		return status;
+
+	//queue is empty, clear readiness and check again for entries pushed meanwhile
+	while(read(n->queue.event_fd, &events, sizeof(events)) < 0 && errno == EINTR)
+		;
+
+	if( (status = nhvd_receive_set(n, frames, raws, 0)) != NHVD_QUEUE_EMPTY)
+		return status;
+
+	return NHVD_WOULD_BLOCK;
+}
+
+int nhvd_get_fd(struct nhvd *n)
+{
+	if(!n->network_thread_running)
+		return NHVD_ERROR_MSG("pollable file descriptor requires receive_queue_size");
+
+	return n->queue.event_fd;
+}
+
+int nhvd_receive_batch(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws, int max_sets)
+{
+	const int hw_size = n->hardware_decoders_size;
+	const int channels = hw_size + n->auxiliary_channels_size;
+	int sets, status;
+
+	if(max_sets <= 0)
+		return NHVD_ERROR_MSG("max_sets has to be positive");
+
+	if(!n->network_thread_running)
+		return (status = nhvd_receive_all(n, frames, raws)) == NHVD_OK ? 1 : status;
+
+	nhvd_queue_release(&n->queue);
+
+	if(nhvd_batch_frames_alloc(n, max_sets * hw_size) != NHVD_OK ||
+		(raws && nhvd_batch_raws_alloc(n, max_sets * channels) != NHVD_OK))
+		return NHVD_ERROR;
 
-	if( (streamer_frame = mlsp_receive(n->network_streamer, &error)) == NULL)
+	for(sets=0;sets<max_sets;++sets)
 	{
-		if(error == MLSP_TIMEOUT)
+		AVFrame **set_frames = frames + sets * hw_size;
+
+		//only the first set may wait
+		status = nhvd_receive_set(n, set_frames, raws ? raws + sets * channels : NULL, sets == 0);
+
+		if(status == NHVD_QUEUE_EMPTY)
+			break;
+
+		if(status == NHVD_TIMEOUT)
+			return sets ? sets : NHVD_TIMEOUT;
+
+		if(status != NHVD_OK)
+			return NHVD_ERROR;
+
+		//decoders reuse their frames, keep own references
+		for(int i=0;i<hw_size;++i)
 		{
-			fprintf(stderr, ".");
-			nhvd_decode_frame(n, NULL);
-			return NHVD_TIMEOUT;
+			AVFrame *frame = n->batch_frame[sets * hw_size + i];
+
+			if(!set_frames[i])
+				continue;
+
+			if(av_frame_ref(frame, set_frames[i]) < 0)
+				return NHVD_ERROR_MSG("failed to reference frame");
+
+			set_frames[i] = frame;
+		}
+
+		//queue entry is free for network thread, raw data stays referenced
+		for(int i=0;raws && i<channels;++i)
+		{
+			struct nhvd_frame *raw = &raws[sets * channels + i];
+
+			if(!raw->buf)
+				continue;
+
+			if( (n->batch_raw[sets * channels + i] = av_buffer_ref(raw->buf)) == NULL)
+				return NHVD_ERROR_MSG("failed to reference raw data");
+
+			raw->buf = n->batch_raw[sets * channels + i];
 		}
-		return NHVD_ERROR_MSG("error while receiving frame");
+
+		nhvd_queue_release(&n->queue);
 	}
 
+	return sets;
+}
+
+//wait 0 to return NHVD_QUEUE_EMPTY instead of waiting for data (threaded receive)
+static int nhvd_receive_set(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws, int wait)
+{
+	int status;
+
+	if(n->network_thread_running)
+		status = nhvd_receive_frame_set_queued(n, wait);
+	else
+		status = nhvd_receive_frame_set(n);
+
+	if(status == NHVD_TIMEOUT)
+		return nhvd_timeout(n);
+
+	if(status != NHVD_OK)
+		return status;
+
 	for(int i=0;i<n->hardware_decoders_size;++i)
 	{
-		packets[i].data = streamer_frame[i].data;
-		packets[i].size = streamer_frame[i].size;
+		n->packet[i] = n->raw[i];
+
+		//raw data is still returned
+		if(nhvd_channel_paused(n, i))
+			n->packet[i].size = 0;
+
+		if(n->channel[i].skip_nonref && n->packet[i].size &&
+			!nhvd_is_reference(n->channel[i].codec, n->packet[i].data, n->packet[i].size))
+			n->packet[i].size = 0;
+
+		if(n->packet[i].size)
+			if( (status = nhvd_channel_configure(n, i)) != NHVD_OK)
+			{
+				if(status != NHVD_NO_SPS)
+					return NHVD_ERROR;
+
+				n->packet[i].size = 0;
+				n->channel[i].keyframe_needed = 1; //SPS comes with keyframe
+			}
+
+		if(n->channel[i].flush_pending && n->packet[i].size)
+			nhvd_flush_pending(n, i);
+
+		if(n->channel[i].wait_keyframe)
+			nhvd_wait_keyframe(n, i);
+
+		nhvd_track_references(n, i);
 	}
 
-	if (nhvd_decode_frame(n, packets) != NHVD_OK)
+	if (nhvd_decode_frame(n, n->packet, 1) != NHVD_OK)
 		return NHVD_ERROR;
 
+	if(n->feedback_fd >= 0)
+		nhvd_request_keyframes(n);
+
 	for(int i=0;i<n->hardware_decoders_size;++i)
-		frames[i] = n->frame[i];
+		frames[i] = n->channel[i].frame;
+
+	nhvd_stats_update(n);
 
 	if(raws)
 		for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
-		{
-			raws[i].data = streamer_frame[i].data;
-			raws[i].size = streamer_frame[i].size;
-		}
+			raws[i] = n->raw[i];
 
 	return NHVD_OK;
 }
 
-//NULL packet to flush all hardware decoders
-static int nhvd_decode_frame(struct nhvd *n, struct hvd_packet *packet)
+//release references from previous batch and make room for size frames
+static int nhvd_batch_frames_alloc(struct nhvd *n, int size)
 {
-	int error = 0;
+	AVFrame **batch_frame;
 
-	for(int i=0;i<n->hardware_decoders_size;++i)
-		n->frame[i] = NULL;
+	for(int i=0;i<n->batch_frames_size;++i)
+		av_frame_unref(n->batch_frame[i]);
 
-	//special NULL packet case with flush request
-	for(int i=0;!packet && i < n->hardware_decoders_size;++i)
-		if(hvd_send_packet(n->hardware_decoder[i], NULL) != HVD_OK)
-			return NHVD_ERROR_MSG("error during decoding (flush)");
+	if(size <= n->batch_frames_size)
+		return NHVD_OK;
 
-	//send data to all hardware decoders
-	for(int i=0;packet && i < n->hardware_decoders_size;++i)
-	{
-		if(!packet[i].size) //silently skip empty subframes
-			continue; //(e.g. different framerates/B frames)
+	if( (batch_frame = (AVFrame**)realloc(n->batch_frame, size * sizeof(AVFrame*))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for batch");
 
-		if(hvd_send_packet(n->hardware_decoder[i], &packet[i]) != HVD_OK)
-			return NHVD_ERROR_MSG("error during decoding");
+	n->batch_frame = batch_frame;
+
+	for(;n->batch_frames_size < size;++n->batch_frames_size)
+		if( (n->batch_frame[n->batch_frames_size] = av_frame_alloc()) == NULL)
+			return NHVD_ERROR_MSG("not enough memory for batch frames");
+
+	return NHVD_OK;
+}
+
+//release raw data references from previous batch and make room for size references
+static int nhvd_batch_raws_alloc(struct nhvd *n, int size)
+{
+	AVBufferRef **batch_raw;
+
+	for(int i=0;i<n->batch_raws_size;++i)
+		av_buffer_unref(&n->batch_raw[i]);
+
+	if(size <= n->batch_raws_size)
+		return NHVD_OK;
+
+	if( (batch_raw = (AVBufferRef**)realloc(n->batch_raw, size * sizeof(AVBufferRef*))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for batch");
+
+	n->batch_raw = batch_raw;
+
+	for(;n->batch_raws_size < size;++n->batch_raws_size)
+		n->batch_raw[n->batch_raws_size] = NULL;
+
+	return NHVD_OK;
+}
+
+int nhvd_start_callbacks(struct nhvd *n, const struct nhvd_callback_config *config)
+{
+	struct nhvd_delivery *d = &n->delivery;
+	const int hw_size = n->hardware_decoders_size;
+
+	if(d->thread_running)
+		return NHVD_ERROR_MSG("callbacks already started");
+
+	if(n->timeout_ms <= 0)
+		return NHVD_ERROR_MSG("callbacks require positive timeout_ms");
+
+	if(config->frame_set && config->channel)
+		return NHVD_ERROR_MSG("use either frame set or channel callback");
+
+	if(!config->frame_set && !config->channel)
+		return NHVD_ERROR_MSG("frame set or channel callback required");
+
+	if(config->frame_pool_size < 0)
+		return NHVD_ERROR_MSG("frame_pool_size has to be 0 or positive");
+
+	d->config = *config;
+	d->pool_size = config->frame_pool_size ? config->frame_pool_size : NHVD_FRAME_POOL_SIZE * (hw_size ? hw_size : 1);
+
+	if( (d->pool = (struct nhvd_pooled_frame*)calloc(d->pool_size, sizeof(struct nhvd_pooled_frame))) == NULL ||
+		(d->frames = (AVFrame**)calloc(hw_size + 1, sizeof(AVFrame*))) == NULL ||
+		(d->pooled = (AVFrame**)calloc(hw_size + 1, sizeof(AVFrame*))) == NULL ||
+		(d->raws = (struct nhvd_frame*)calloc(hw_size + n->auxiliary_channels_size + 1, sizeof(struct nhvd_frame))) == NULL)
+	{
+		nhvd_delivery_close(n);
+		return NHVD_ERROR_MSG("not enough memory for callbacks");
 	}
 
-	//receive data from all hardware decoders
-	for(int i=0;i<n->hardware_decoders_size;++i)
+	//preallocated, no per frame allocation of AVFrame
+	for(int i=0;i<d->pool_size;++i)
+		if( (d->pool[i].frame = av_frame_alloc()) == NULL)
+		{
+			nhvd_delivery_close(n);
+			return NHVD_ERROR_MSG("not enough memory for frame pool");
+		}
+
+	atomic_store(&d->keep_working, 1);
+
+	if(pthread_create(&d->thread, NULL, nhvd_delivery_thread, n) != 0)
 	{
-		if(packet && !packet[i].size) //silently skip empty subframes
-			continue; //(e.g. different framerates/B frames)
+		nhvd_delivery_close(n);
+		return NHVD_ERROR_MSG("failed to create delivery thread");
+	}
 
-		//non NULL packet - get single frame
-		//NULL packet - flush the decoder, work until hardware is flushed
-		do
-			n->frame[i] = hvd_receive_frame(n->hardware_decoder[i], &error);
-		while(!packet && n->frame[i]);
+	d->thread_running = 1;
 
-		if(error != NHVD_OK)
-			return NHVD_ERROR_MSG("error after decoding");
+	//the delivery thread receives and decodes
+	if(nhvd_thread_tune(n, d->thread, n->decoding_cpus) != NHVD_OK)
+	{
+		nhvd_delivery_close(n);
+		return NHVD_ERROR;
 	}
 
 	return NHVD_OK;
 }
 
+void nhvd_frame_release(struct nhvd *n, AVFrame *frame)
+{
+	struct nhvd_delivery *d = &n->delivery;
+
+	if(frame == NULL)
+		return;
+
+	for(int i=0;i<d->pool_size;++i)
+		if(d->pool[i].frame == frame)
+		{
+			av_frame_unref(frame);
+			atomic_store_explicit(&d->pool[i].in_use, 0, memory_order_release);
+			return;
+		}
+
+	NHVD_ERROR_MSG("released frame is not from frame pool");
+}
+
+static void *nhvd_delivery_thread(void *arg)
+{
+	struct nhvd *n = (struct nhvd*)arg;
+	struct nhvd_delivery *d = &n->delivery;
+	int status;
+
+	while(atomic_load(&d->keep_working))
+	{
+		status = nhvd_receive_all(n, d->frames, d->raws);
+
+		if(status == NHVD_TIMEOUT && d->config.channel)
+			continue;
+
+		for(int i=0;status == NHVD_OK && i<n->hardware_decoders_size;++i)
+			d->pooled[i] = nhvd_pool_acquire(d, d->frames[i]);
+
+		if(d->config.frame_set)
+			d->config.frame_set(status == NHVD_OK ? d->pooled : NULL, status == NHVD_OK ? d->raws : NULL, status, d->config.user);
+		else if(status == NHVD_OK)
+		{
+			for(int i=0;i<n->hardware_decoders_size;++i)
+				if(d->pooled[i])
+					d->config.channel(i, d->pooled[i], &d->raws[i], d->config.user);
+		}
+		else //error, the last call for every channel
+			for(int i=0;i<n->hardware_decoders_size;++i)
+				d->config.channel(i, NULL, NULL, d->config.user);
+
+		if(status == NHVD_ERROR)
+			break;
+	}
+
+	return NULL;
+}
+
+//reference decoded frame in free pool frame, NULL if user holds all of them
+static AVFrame *nhvd_pool_acquire(struct nhvd_delivery *d, AVFrame *frame)
+{
+	if(frame == NULL)
+		return NULL;
+
+	for(int i=0;i<d->pool_size;++i)
+	{
+		struct nhvd_pooled_frame *p = &d->pool[i];
+
+		if(atomic_load_explicit(&p->in_use, memory_order_acquire))
+			continue;
+
+		//the decoder data is referenced, not copied
+		if(av_frame_ref(p->frame, frame) < 0)
+			break;
+
+		atomic_store_explicit(&p->in_use, 1, memory_order_relaxed);
+
+		return p->frame;
+	}
+
+	atomic_fetch_add_explicit(&d->pool_exhausted, 1, memory_order_relaxed);
+
+	return NULL;
+}
+
+static void nhvd_delivery_close(struct nhvd *n)
+{
+	struct nhvd_delivery *d = &n->delivery;
+	struct nhvd_delivery zero_delivery = {0};
+
+	if(d->thread_running)
+	{
+		atomic_store(&d->keep_working, 0);
+		pthread_join(d->thread, NULL);
+	}
+
+	for(int i=0;d->pool && i<d->pool_size;++i)
+		av_frame_free(&d->pool[i].frame);
+
+	free(d->pool);
+	free(d->frames);
+	free(d->pooled);
+	free(d->raws);
+
+	*d = zero_delivery;
+}
+
+int nhvd_get_stats(struct nhvd *n, struct nhvd_stats *stats, struct nhvd_channel_stats *channels)
+{
+	struct nhvd_stats zero_stats = {0};
+	const int64_t now = nhvd_time_ns();
+	const double elapsed_s = (now - n->stats_time_ns) / 1000000000.0;
+
+	*stats = zero_stats;
+	stats->timeouts = n->timeouts;
+	stats->flushes = n->flushes;
+	stats->pool_exhausted = atomic_load_explicit(&n->delivery.pool_exhausted, memory_order_relaxed);
+	stats->jitter_us = n->jitter.jitter_ns / 1000;
+	stats->jitter_delay_us = n->jitter.target_ns / 1000;
+	stats->init_ms = (n->ready_ns - n->init_ns) / 1000000.0;
+	stats->first_frame_ms = n->first_frame_ns ? (n->first_frame_ns - n->init_ns) / 1000000.0 : 0;
+
+	//single syscall, cheap enough to call per frame
+	if(n->socket_fd >= 0)
+	{
+		uint32_t meminfo[SK_MEMINFO_VARS] = {0};
+		socklen_t length = sizeof(meminfo);
+
+		if(getsockopt(n->socket_fd, SOL_SOCKET, SO_MEMINFO, meminfo, &length) == 0)
+		{
+			stats->socket_drops = meminfo[SK_MEMINFO_DROPS];
+			stats->socket_buffer_size = meminfo[SK_MEMINFO_RCVBUF];
+		}
+	}
+
+	if(n->network_thread_running)
+		nhvd_get_queue_stats(n, &stats->queue);
+
+	if(n->recorder)
+	{
+		struct nhvd_recorder *r = n->recorder;
+
+		stats->capture.size = r->size;
+		stats->capture.depth = atomic_load(&r->head) - atomic_load(&r->tail);
+		stats->capture.max_depth = atomic_load(&r->max_depth);
+		stats->capture.recorded = atomic_load(&r->recorded);
+		stats->capture.dropped = atomic_load(&r->dropped);
+		stats->capture.bytes = atomic_load(&r->bytes);
+	}
+
+	for(int i=0;channels && i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+	{
+		struct nhvd_channel_counters *c = &n->counters[i];
+		struct nhvd_channel_stats *s = &channels[i];
+
+		s->received = c->received;
+		s->decoded = c->decoded;
+		s->dropped = c->dropped;
+		s->incomplete = c->incomplete;
+		s->paused = c->paused;
+		s->reconfigured = c->reconfigured;
+		s->reference_losses = c->reference_losses;
+		s->keyframe_requests = c->keyframe_requests;
+		s->first_frame_ms = c->first_frame_ns ? (c->first_frame_ns - n->init_ns) / 1000000.0 : 0;
+		s->bytes = c->bytes;
+		s->bytes_per_second = elapsed_s > 0 ? (c->bytes - c->reported_bytes) / elapsed_s : 0;
+		c->reported_bytes = c->bytes;
+
+		for(int stage=0;stage<NHVD_STAGES;++stage)
+			nhvd_histogram_stats(&c->latency[stage], &s->latency[stage]);
+	}
+
+	n->stats_time_ns = now;
+
+	return NHVD_OK;
+}
+
+//account frame set handed to the user
+static void nhvd_stats_update(struct nhvd *n)
+{
+	const int64_t now = nhvd_time_ns();
+
+	for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+	{
+		struct nhvd_channel_counters *c = &n->counters[i];
+
+		if(!n->raw[i].size)
+			continue;
+
+		++c->received;
+		c->bytes += n->raw[i].size;
+
+		if(i >= n->hardware_decoders_size) //auxiliary channel
+		{
+			nhvd_histogram_add(&c->latency[NHVD_STAGE_TOTAL], now - n->received_ns);
+			continue;
+		}
+
+		const struct nhvd_channel *ch = &n->channel[i];
+
+		if(ch->decoding_paused)
+			++c->paused;
+		else if(!n->packet[i].size) //waiting for keyframe
+			++c->dropped;
+		else if(!ch->frame)
+			++c->incomplete;
+		else
+		{
+			++c->decoded;
+
+			if(!c->first_frame_ns)
+				c->first_frame_ns = now;
+			if(!n->first_frame_ns)
+				n->first_frame_ns = now;
+
+			nhvd_histogram_add(&c->latency[NHVD_STAGE_QUEUE], ch->send_ns - n->received_ns);
+			nhvd_histogram_add(&c->latency[NHVD_STAGE_DECODE], ch->decoded_ns - ch->send_ns);
+			nhvd_histogram_add(&c->latency[NHVD_STAGE_DELIVERY], now - ch->decoded_ns);
+			nhvd_histogram_add(&c->latency[NHVD_STAGE_TOTAL], now - n->received_ns);
+		}
+	}
+}
+
+//account frame set that is not handed to the user
+static void nhvd_stats_drop(struct nhvd *n, const struct nhvd_queue_entry *entry)
+{
+	for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+		if(entry->buffer[i].size)
+		{
+			++n->counters[i].received;
+			++n->counters[i].dropped;
+			n->counters[i].bytes += entry->buffer[i].size;
+		}
+}
+
+static int64_t nhvd_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//log-linear buckets, 4 per power of 2 microseconds, 0-3 us exact (contiguous, all used)
+static int nhvd_histogram_bucket(uint32_t us)
+{
+	int msb, bucket;
+
+	if(us < 4)
+		return us;
+
+	msb = 31 - __builtin_clz(us);
+	bucket = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+
+	return bucket < NHVD_HISTOGRAM_BUCKETS ? bucket : NHVD_HISTOGRAM_BUCKETS - 1;
+}
+
+//exclusive upper bound of bucket in microseconds
+static uint32_t nhvd_histogram_bucket_end(int bucket)
+{
+	if(bucket < 4)
+		return bucket + 1;
+
+	return (uint32_t)(4 + (bucket & 3) + 1) << (bucket / 4 - 1);
+}
+
+static void nhvd_histogram_add(struct nhvd_histogram *h, int64_t ns)
+{
+	const uint32_t us = ns <= 0 ? 0 : ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(ns / 1000);
+
+	if(!h->count || us < h->min_us)
+		h->min_us = us;
+	if(us > h->max_us)
+		h->max_us = us;
+
+	++h->count;
+	h->sum_us += us;
+	++h->bucket[nhvd_histogram_bucket(us)];
+}
+
+static void nhvd_histogram_stats(const struct nhvd_histogram *h, struct nhvd_latency_stats *stats)
+{
+	struct nhvd_latency_stats zero_stats = {0};
+	uint64_t cumulative = 0;
+	uint32_t p99_us = h->max_us;
+
+	*stats = zero_stats;
+
+	if(!h->count)
+		return;
+
+	for(int i=0;i<NHVD_HISTOGRAM_BUCKETS;++i)
+		if( (cumulative += h->bucket[i]) * 100 >= h->count * 99)
+		{
+			if(nhvd_histogram_bucket_end(i) < p99_us)
+				p99_us = nhvd_histogram_bucket_end(i);
+			break;
+		}
+
+	stats->count = h->count;
+	stats->min_ms = h->min_us / 1000.0;
+	stats->avg_ms = h->sum_us / 1000.0 / h->count;
+	stats->p99_ms = p99_us / 1000.0;
+	stats->max_ms = h->max_us / 1000.0;
+}
+
+int nhvd_frame_ref(struct nhvd_frame *dst, const struct nhvd_frame *src)
+{
+	struct nhvd_frame zero_frame = {0};
+
+	*dst = zero_frame;
+
+	if(!src->size)
+		return NHVD_OK;
+
+	if(src->buf)
+	{
+		if( (dst->buf = av_buffer_ref(src->buf)) == NULL)
+			return NHVD_ERROR_MSG("failed to reference frame");
+	}
+	else //not reference counted, copy
+	{
+		if( (dst->buf = av_buffer_alloc(src->size + AV_INPUT_BUFFER_PADDING_SIZE)) == NULL)
+			return NHVD_ERROR_MSG("not enough memory for frame");
+
+		memcpy(dst->buf->data, src->data, src->size);
+		memset(dst->buf->data + src->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+	}
+
+	dst->data = dst->buf->data + (src->buf ? src->data - src->buf->data : 0);
+	dst->size = src->size;
+
+	return NHVD_OK;
+}
+
+void nhvd_frame_unref(struct nhvd_frame *frame)
+{
+	av_buffer_unref(&frame->buf);
+	frame->data = NULL;
+	frame->size = 0;
+}
+
+int nhvd_get_queue_stats(struct nhvd *n, struct nhvd_queue_stats *stats)
+{
+	struct nhvd_queue *q = &n->queue;
+
+	if(!n->network_thread_running)
+		return NHVD_ERROR_MSG("network receive thread is not used");
+
+	stats->size = q->size - 1;
+	stats->depth = atomic_load(&q->head) - atomic_load(&q->tail) - q->held;
+	stats->max_depth = q->max_depth;
+	stats->received = atomic_load(&q->received);
+	stats->dropped = atomic_load(&q->dropped);
+	stats->skipped = q->skipped;
+
+	return NHVD_OK;
+}
+
+//receive frame set on caller thread
+static int nhvd_receive_frame_set(struct nhvd *n)
+{
+	const struct mlsp_frame *streamer_frame;
+	int status;
+
+	if( (status = nhvd_source_receive(n, &streamer_frame)) != NHVD_OK)
+		return status;
+
+	n->received_ns = nhvd_received_ns(n);
+
+	for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+	{
+		n->raw[i].data = streamer_frame[i].data;
+		n->raw[i].size = streamer_frame[i].size;
+	}
+
+	//not reference counted, copied to pooled buffers for I/O thread
+	if(n->recorder)
+		nhvd_recorder_push(n->recorder, n->raw, n->received_ns);
+
+	return NHVD_OK;
+}
+
+//receive frame set from network or replayed capture
+static int nhvd_source_receive(struct nhvd *n, const struct mlsp_frame **frame)
+{
+	int error;
+
+	if(n->replay.file)
+		return nhvd_replay_receive(n, frame);
+
+	if( (*frame = mlsp_receive(n->network_streamer, &error)) != NULL )
+		return NHVD_OK;
+
+	if(error == MLSP_TIMEOUT)
+		return NHVD_TIMEOUT;
+
+	return NHVD_ERROR_MSG("error while receiving frame");
+}
+
+static struct nhvd_recorder *nhvd_recorder_init(const char *file, int size, int channels)
+{
+	struct nhvd_recorder *r, zero_recorder = {0};
+	struct nhvd_capture_header header = {NHVD_CAPTURE_MAGIC, (uint32_t)channels, 0};
+
+	if( (r = (struct nhvd_recorder*)malloc(sizeof(struct nhvd_recorder))) == NULL)
+		return nhvd_recorder_close_and_return_null(NULL, "not enough memory for capture");
+
+	*r = zero_recorder;
+	r->fd = -1;
+	r->channels = channels;
+	r->size = size;
+
+	if( (r->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return nhvd_recorder_close_and_return_null(r, "failed to create capture file");
+
+	if( (r->buffer = (uint8_t*)aligned_alloc(NHVD_CAPTURE_ALIGN, NHVD_CAPTURE_BUFFER)) == NULL ||
+		(r->slot = (struct nhvd_recorder_slot*)calloc(size, sizeof(struct nhvd_recorder_slot))) == NULL ||
+		(r->pool = (AVBufferPool**)calloc(channels, sizeof(AVBufferPool*))) == NULL ||
+		(r->pool_size = (int*)calloc(channels, sizeof(int))) == NULL)
+		return nhvd_recorder_close_and_return_null(r, "not enough memory for capture");
+
+	for(int i=0;i<size;++i)
+		if( (r->slot[i].frame = (struct nhvd_frame*)calloc(channels, sizeof(struct nhvd_frame))) == NULL)
+			return nhvd_recorder_close_and_return_null(r, "not enough memory for capture");
+
+	nhvd_recorder_append(r, &header, sizeof(header));
+
+	if(sem_init(&r->ready, 0, 0) != 0)
+		return nhvd_recorder_close_and_return_null(r, "failed to initialize capture semaphore");
+
+	r->ready_initialized = 1;
+
+	atomic_store(&r->keep_working, 1);
+
+	if(pthread_create(&r->thread, NULL, nhvd_recorder_thread, r) != 0)
+		return nhvd_recorder_close_and_return_null(r, "failed to create capture thread");
+
+	r->thread_running = 1;
+
+	return r;
+}
+
+//waits until everything queued is written
+static void nhvd_recorder_close(struct nhvd_recorder *r)
+{
+	if(r == NULL)
+		return;
+
+	if(r->thread_running)
+	{
+		atomic_store(&r->keep_working, 0);
+		sem_post(&r->ready);
+		pthread_join(r->thread, NULL);
+	}
+
+	if(r->fd != -1 && !atomic_load(&r->error) && nhvd_recorder_flush(r, 1) != NHVD_OK)
+		NHVD_ERROR_MSG("failed to write capture file");
+
+	if(r->fd != -1)
+		close(r->fd);
+
+	if(r->ready_initialized)
+		sem_destroy(&r->ready);
+
+	for(unsigned int i=0;r->slot && i<r->size;++i)
+	{
+		for(int c=0;r->slot[i].frame && c<r->channels;++c)
+			nhvd_frame_unref(&r->slot[i].frame[c]);
+
+		free(r->slot[i].frame);
+	}
+
+	for(int c=0;r->pool && c<r->channels;++c)
+		av_buffer_pool_uninit(&r->pool[c]);
+
+	free(r->slot);
+	free(r->pool);
+	free(r->pool_size);
+	free(r->buffer);
+	free(r);
+}
+
+static struct nhvd_recorder *nhvd_recorder_close_and_return_null(struct nhvd_recorder *r, const char *msg)
+{
+	if(msg)
+		fprintf(stderr, "nhvd: %s\n", msg);
+
+	nhvd_recorder_close(r);
+
+	return NULL;
+}
+
+//called only from receiving thread, never blocks, drops when I/O thread doesn't keep up
+static void nhvd_recorder_push(struct nhvd_recorder *r, const struct nhvd_frame *frame, int64_t received_ns)
+{
+	const unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	const unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	struct nhvd_recorder_slot *slot = &r->slot[head % r->size];
+	const int depth = head - tail + 1;
+
+	if(head - tail >= r->size || atomic_load_explicit(&r->error, memory_order_relaxed))
+	{
+		atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	for(int i=0;i<r->channels;++i)
+		if(nhvd_recorder_ref(r, i, &slot->frame[i], &frame[i]) != NHVD_OK)
+		{
+			for(int c=0;c<i;++c)
+				nhvd_frame_unref(&slot->frame[c]);
+
+			atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+			return;
+		}
+
+	slot->received_ns = received_ns;
+
+	if(depth > atomic_load_explicit(&r->max_depth, memory_order_relaxed))
+		atomic_store_explicit(&r->max_depth, depth, memory_order_relaxed);
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	sem_post(&r->ready);
+}
+
+//reference counted data is referenced, other is copied to pooled buffer (no allocation per frame)
+static int nhvd_recorder_ref(struct nhvd_recorder *r, int channel, struct nhvd_frame *dst, const struct nhvd_frame *src)
+{
+	if(src->buf || !src->size)
+		return nhvd_frame_ref(dst, src);
+
+	if( (dst->buf = nhvd_pool_buffer(&r->pool[channel], &r->pool_size[channel], src->size)) == NULL)
+		return NHVD_ERROR;
+
+	memcpy(dst->buf->data, src->data, src->size);
+	dst->data = dst->buf->data;
+	dst->size = src->size;
+
+	return NHVD_OK;
+}
+
+static void *nhvd_recorder_thread(void *arg)
+{
+	struct nhvd_recorder *r = (struct nhvd_recorder*)arg;
+
+	while(1)
+	{
+		const unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+		if(atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+		{
+			if(!atomic_load(&r->keep_working))
+				break;
+
+			//idle, let the capture be read while streaming
+			if(!atomic_load(&r->error) && nhvd_recorder_flush(r, 0) != NHVD_OK)
+				atomic_store(&r->error, 1);
+		}
+
+		//exactly one post per pushed slot and one on close, consumed before the slot
+		while(sem_wait(&r->ready) != 0 && errno == EINTR)
+			;
+
+		if(atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+			continue; //closing
+
+		if(atomic_load(&r->error))
+			atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		else if(nhvd_recorder_write_slot(r, &r->slot[tail % r->size]) != NHVD_OK)
+		{
+			NHVD_ERROR_MSG("failed to write capture file, capturing stopped");
+			atomic_store(&r->error, 1);
+			atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		}
+		else
+			atomic_fetch_add_explicit(&r->recorded, 1, memory_order_relaxed);
+
+		for(int c=0;c<r->channels;++c)
+			nhvd_frame_unref(&r->slot[tail % r->size].frame[c]);
+
+		atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	}
+
+	return NULL;
+}
+
+static int nhvd_recorder_write_slot(struct nhvd_recorder *r, struct nhvd_recorder_slot *slot)
+{
+	const struct nhvd_capture_record record = {NHVD_CAPTURE_RECORD_MAGIC, (uint32_t)r->channels, slot->received_ns};
+
+	if(nhvd_recorder_append(r, &record, sizeof(record)) != NHVD_OK)
+		return NHVD_ERROR;
+
+	for(int i=0;i<r->channels;++i)
+	{
+		const uint32_t size = slot->frame[i].size;
+
+		if(nhvd_recorder_append(r, &size, sizeof(size)) != NHVD_OK)
+			return NHVD_ERROR;
+	}
+
+	for(int i=0;i<r->channels;++i)
+		if(nhvd_recorder_append(r, slot->frame[i].data, slot->frame[i].size) != NHVD_OK)
+			return NHVD_ERROR;
+
+	return NHVD_OK;
+}
+
+//copy to staging buffer, write it out in NHVD_CAPTURE_BUFFER chunks
+static int nhvd_recorder_append(struct nhvd_recorder *r, const void *data, size_t size)
+{
+	const uint8_t *src = (const uint8_t*)data;
+
+	while(size)
+	{
+		const size_t free_space = NHVD_CAPTURE_BUFFER - r->used;
+		const size_t n = size < free_space ? size : free_space;
+
+		memcpy(r->buffer + r->used, src, n);
+		r->used += n;
+		src += n;
+		size -= n;
+
+		if(r->used == NHVD_CAPTURE_BUFFER && nhvd_recorder_flush(r, 1) != NHVD_OK)
+			return NHVD_ERROR;
+	}
+
+	return NHVD_OK;
+}
+
+//write aligned part of staging buffer or all of it
+static int nhvd_recorder_flush(struct nhvd_recorder *r, int all)
+{
+	const size_t size = all ? r->used : r->used / NHVD_CAPTURE_ALIGN * NHVD_CAPTURE_ALIGN;
+	size_t written = 0;
+
+	while(written < size)
+	{
+		const ssize_t w = write(r->fd, r->buffer + written, size - written);
+
+		if(w < 0 && errno == EINTR)
+			continue;
+
+		if(w <= 0)
+			return NHVD_ERROR;
+
+		written += w;
+		atomic_fetch_add_explicit(&r->bytes, w, memory_order_relaxed);
+	}
+
+	memmove(r->buffer, r->buffer + size, r->used - size);
+	r->used -= size;
+
+	return NHVD_OK;
+}
+
+static int nhvd_replay_init(struct nhvd_replay *r, const char *file, int timing, int channels)
+{
+	struct nhvd_capture_header header;
+
+	r->timing = timing;
+
+	if( (r->file = fopen(file, "rb")) == NULL)
+		return NHVD_ERROR_MSG("failed to open replay file");
+
+	if(fread(&header, sizeof(header), 1, r->file) != 1 ||
+		memcmp(header.magic, NHVD_CAPTURE_MAGIC, sizeof(header.magic)) != 0)
+		return NHVD_ERROR_MSG("replay file is not nhvd capture");
+
+	if(header.channels != (uint32_t)channels)
+		return NHVD_ERROR_MSG("replay file channels don't match hw_size + aux_size");
+
+	if( (r->size = (uint32_t*)calloc(channels, sizeof(uint32_t))) == NULL ||
+		(r->frame = (struct mlsp_frame*)calloc(channels, sizeof(struct mlsp_frame))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for replay");
+
+	return NHVD_OK;
+}
+
+static void nhvd_replay_close(struct nhvd_replay *r)
+{
+	if(r->file)
+		fclose(r->file);
+
+	free(r->size);
+	free(r->frame);
+	free(r->data);
+}
+
+//next frame set from capture, with original timing wait until it is due
+static int nhvd_replay_receive(struct nhvd *n, const struct mlsp_frame **frame)
+{
+	struct nhvd_replay *r = &n->replay;
+
+	if(!r->pending && nhvd_replay_read(r, n->hardware_decoders_size + n->auxiliary_channels_size) != NHVD_OK)
+		return NHVD_ERROR;
+
+	r->pending = 1;
+
+	if(r->timing)
+	{
+		const int64_t timeout_ns = n->timeout_ms * 1000000LL;
+		int64_t due_ns;
+		int timeout;
+		struct timespec ts;
+
+		if(!r->start_ns)
+		{
+			r->start_ns = nhvd_time_ns();
+			r->first_ns = r->record.received_ns;
+		}
+
+		due_ns = r->start_ns + r->record.received_ns - r->first_ns;
+
+		//the network would time out on such gap in stream
+		if( (timeout = timeout_ns && due_ns - nhvd_time_ns() > timeout_ns) )
+			due_ns = nhvd_time_ns() + timeout_ns;
+
+		ts.tv_sec = due_ns / 1000000000LL;
+		ts.tv_nsec = due_ns % 1000000000LL;
+
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+
+		if(timeout)
+			return NHVD_TIMEOUT;
+	}
+
+	r->pending = 0;
+	*frame = r->frame;
+
+	return NHVD_OK;
+}
+
+//read next record to replay buffers
+static int nhvd_replay_read(struct nhvd_replay *r, int channels)
+{
+	size_t total = 0;
+
+	if(fread(&r->record, sizeof(r->record), 1, r->file) != 1)
+		return NHVD_ERROR_MSG(feof(r->file) ? "end of replay file" : "failed to read replay file");
+
+	if(r->record.magic != NHVD_CAPTURE_RECORD_MAGIC || r->record.channels != (uint32_t)channels ||
+		fread(r->size, sizeof(uint32_t), channels, r->file) != (size_t)channels)
+		return NHVD_ERROR_MSG("corrupted replay file");
+
+	for(int i=0;i<channels;++i)
+		total += r->size[i];
+
+	//libavcodec may read past the end of data
+	if(total + AV_INPUT_BUFFER_PADDING_SIZE > r->data_size)
+	{
+		uint8_t *data = (uint8_t*)realloc(r->data, total + AV_INPUT_BUFFER_PADDING_SIZE);
+
+		if(data == NULL)
+			return NHVD_ERROR_MSG("not enough memory for replay");
+
+		r->data = data;
+		r->data_size = total + AV_INPUT_BUFFER_PADDING_SIZE;
+	}
+
+	if(fread(r->data, 1, total, r->file) != total)
+		return NHVD_ERROR_MSG("truncated replay file");
+
+	memset(r->data + total, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	total = 0;
+
+	for(int i=0;i<channels;++i)
+	{
+		r->frame[i].data = r->size[i] ? r->data + total : NULL;
+		r->frame[i].size = r->size[i];
+		total += r->size[i];
+	}
+
+	return NHVD_OK;
+}
+
+//take next frame set received by network thread
+static int nhvd_receive_frame_set_queued(struct nhvd *n, int wait)
+{
+	struct nhvd_queue *q = &n->queue;
+	struct nhvd_queue_entry *entry;
+	unsigned int tail;
+	int depth, status;
+
+	if( (status = nhvd_queue_wait(n, wait)) != NHVD_OK)
+		return status;
+
+	//skip entries already returned in this call
+	tail = atomic_load_explicit(&q->tail, memory_order_relaxed) + q->held;
+	depth = atomic_load_explicit(&q->head, memory_order_acquire) - tail;
+
+	if(depth > q->max_depth)
+		q->max_depth = depth;
+
+	//the entries held by caller can't be skipped
+	if(n->max_backlog && !q->held && depth > n->max_backlog)
+		if(nhvd_shed_backlog(n, &tail, tail + depth) != NHVD_OK)
+			return NHVD_ERROR;
+
+	entry = &q->entry[tail % q->size];
+	++q->held;
+
+	n->received_ns = entry->received_ns;
+
+	//stall ends the stream timeline, start over
+	if(n->jitter.max_ns && entry->status == NHVD_TIMEOUT)
+		n->jitter.previous_ns = 0;
+
+	if(n->jitter.max_ns && entry->status == NHVD_OK && wait)
+		nhvd_jitter_wait(&n->jitter, entry->received_ns);
+
+	for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+		nhvd_buffer_frame(&entry->buffer[i], &n->raw[i]);
+
+	return entry->status;
+}
+
+//wait for the next entry, without waiting return NHVD_QUEUE_EMPTY
+static int nhvd_queue_wait(struct nhvd *n, int wait)
+{
+	struct nhvd_queue *q = &n->queue;
+	struct timespec deadline;
+
+	while(!wait && sem_trywait(&q->ready) != 0)
+	{
+		if(errno == EINTR)
+			continue;
+
+		if(errno != EAGAIN)
+			return NHVD_ERROR_MSG("failed to check receive queue");
+
+		if(atomic_load(&n->network_error))
+			return NHVD_ERROR_MSG("network receive thread stopped");
+
+		return NHVD_QUEUE_EMPTY;
+	}
+
+	if(!wait)
+		return NHVD_OK;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += n->timeout_ms / 1000;
+	deadline.tv_nsec += (n->timeout_ms % 1000) * 1000000L;
+
+	if(deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while(sem_timedwait(&q->ready, &deadline) != 0)
+	{
+		if(errno == EINTR)
+			continue;
+
+		if(errno != ETIMEDOUT)
+			return NHVD_ERROR_MSG("failed to wait for receive queue");
+
+		if(atomic_load(&n->network_error))
+			return NHVD_ERROR_MSG("network receive thread stopped");
+
+		return NHVD_TIMEOUT;
+	}
+
+	return NHVD_OK;
+}
+
+//release entries returned by previous call
+static void nhvd_queue_release(struct nhvd_queue *q)
+{
+	const unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+	if(!q->held)
+		return;
+
+	atomic_store_explicit(&q->tail, tail + q->held, memory_order_release);
+	q->held = 0;
+}
+
+//skip or decode without output stale frame sets, tail is moved to the freshest kept
+static int nhvd_shed_backlog(struct nhvd *n, unsigned int *tail, unsigned int head)
+{
+	struct nhvd_queue *q = &n->queue;
+	unsigned int fresh = head - 1;
+	int keyframe = 0;
+
+	//the newest set with keyframes that is not the oldest (nothing to gain there)
+	for(unsigned int i = head - 1; n->backlog_policy == NHVD_BACKLOG_KEYFRAME && i != *tail; --i)
+		if(nhvd_is_keyframe_set(n, &q->entry[i % q->size]))
+		{
+			fresh = i;
+			keyframe = 1;
+			break;
+		}
+
+	while(*tail != fresh)
+	{
+		if(n->backlog_policy == NHVD_BACKLOG_DECODE)
+			if(nhvd_decode_stale(n, &q->entry[*tail % q->size]) != NHVD_OK)
+				return NHVD_ERROR;
+
+		nhvd_stats_drop(n, &q->entry[*tail % q->size]);
+		atomic_store_explicit(&q->tail, ++(*tail), memory_order_release);
+		++q->skipped;
+
+		//the entry is already published, its post follows immediately
+		while(sem_wait(&q->ready) != 0 && errno == EINTR)
+			;
+	}
+
+	if(n->backlog_policy == NHVD_BACKLOG_KEYFRAME && !keyframe)
+		for(int i=0;i<n->hardware_decoders_size;++i)
+			n->channel[i].wait_keyframe = 1;
+
+	return NHVD_OK;
+}
+
+//decode frame set without returning the frames
+static int nhvd_decode_stale(struct nhvd *n, const struct nhvd_queue_entry *entry)
+{
+	int status;
+
+	//the same timeout_policy as for timeout returned to the user
+	if(entry->status == NHVD_TIMEOUT)
+	{
+		nhvd_timeout(n);
+		return NHVD_OK;
+	}
+
+	for(int i=0;i<n->hardware_decoders_size;++i)
+	{
+		nhvd_buffer_frame(&entry->buffer[i], &n->packet[i]);
+
+		if(nhvd_channel_paused(n, i))
+			n->packet[i].size = 0;
+
+		if(n->packet[i].size)
+			if( (status = nhvd_channel_configure(n, i)) != NHVD_OK)
+			{
+				if(status != NHVD_NO_SPS)
+					return NHVD_ERROR;
+
+				n->packet[i].size = 0;
+				n->channel[i].keyframe_needed = 1;
+			}
+
+		if(n->channel[i].flush_pending && n->packet[i].size)
+			nhvd_flush_pending(n, i);
+
+		//resumed channel doesn't decode backlog before keyframe
+		if(n->channel[i].wait_keyframe)
+			nhvd_wait_keyframe(n, i);
+
+		//software decoders may skip non-reference frames entirely
+		if(n->channel[i].software_decoder)
+			n->channel[i].software_decoder->decoder_ctx->skip_frame = AVDISCARD_NONREF;
+		//hardware decoders don't have to see them at all
+		else if(n->packet[i].size && !nhvd_is_reference(n->channel[i].codec, n->packet[i].data, n->packet[i].size))
+			n->packet[i].size = 0;
+
+		nhvd_track_references(n, i);
+	}
+
+	//the frames are discarded, no color conversion
+	status = nhvd_decode_frame(n, n->packet, 0);
+
+	for(int i=0;i<n->hardware_decoders_size;++i)
+		if(n->channel[i].software_decoder)
+			n->channel[i].software_decoder->decoder_ctx->skip_frame = n->channel[i].software_decoder->skip_frame;
+
+	return status;
+}
+
+//apply timeout_policy, the stream may continue or restart after timeout
+static int nhvd_timeout(struct nhvd *n)
+{
+	++n->timeouts;
+
+	if(n->timeout_policy == NHVD_TIMEOUT_KEEP)
+		return NHVD_TIMEOUT;
+
+	if(n->timeout_policy == NHVD_TIMEOUT_LAZY)
+	{
+		for(int i=0;i<n->hardware_decoders_size;++i)
+			n->channel[i].flush_pending = 1;
+
+		return NHVD_TIMEOUT;
+	}
+
+	++n->flushes;
+	nhvd_decode_frame(n, NULL, 0);
+
+	//flushed references, unless the stream restarts with keyframe
+	for(int i=0;i<n->hardware_decoders_size;++i)
+		n->channel[i].keyframe_needed = 1;
+
+	return NHVD_TIMEOUT;
+}
+
+//hold frame set until its smoothed release time
+//frame sets are paced by the inter-arrival interval, drifting towards buffer depth
+//that covers the measured jitter, but never later than max_ns after arrival
+static void nhvd_jitter_wait(struct nhvd_jitter *j, int64_t received_ns)
+{
+	struct timespec release;
+	int64_t release_ns;
+
+	if(!j->previous_ns)
+	{
+		j->previous_ns = j->release_ns = received_ns;
+		return;
+	}
+
+	const int64_t interval = received_ns - j->previous_ns;
+	const int64_t deviation = interval > j->interval_ns ? interval - j->interval_ns : j->interval_ns - interval;
+
+	//RFC 3550 style estimators, the first interval is taken as is
+	j->jitter_ns += j->interval_ns ? (deviation - j->jitter_ns) / 16 : 0;
+	j->interval_ns += j->interval_ns ? (interval - j->interval_ns) / 16 : interval;
+	j->target_ns = 3 * j->jitter_ns < j->max_ns ? 3 * j->jitter_ns : j->max_ns;
+	j->previous_ns = received_ns;
+
+	release_ns = j->release_ns + j->interval_ns;
+	release_ns += (received_ns + j->target_ns - release_ns) / 8;
+
+	if(release_ns < received_ns)
+		release_ns = received_ns;
+	if(release_ns > received_ns + j->max_ns)
+		release_ns = received_ns + j->max_ns;
+
+	j->release_ns = release_ns;
+
+	release.tv_sec = release_ns / 1000000000LL;
+	release.tv_nsec = release_ns % 1000000000LL;
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &release, NULL) == EINTR)
+		;
+}
+
+//first data after timeout, flush only if it starts new sequence
+static void nhvd_flush_pending(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	const struct nhvd_frame *packet = &n->packet[channel];
+
+	c->flush_pending = 0;
+
+	//without keyframe detection assume new sequence
+	if(c->codec != NHVD_CODEC_OTHER && !nhvd_is_keyframe(c->codec, packet->data, packet->size))
+		return;
+
+	++n->flushes;
+	nhvd_decode_channel(n, channel, NULL, 0);
+}
+
+int nhvd_pause_channel(struct nhvd *n, int channel)
+{
+	if(channel < 0 || channel >= n->hardware_decoders_size)
+		return NHVD_ERROR_MSG("channel has to be index of hardware decoder");
+
+	atomic_store(&n->channel[channel].paused, 1);
+
+	return NHVD_OK;
+}
+
+int nhvd_resume_channel(struct nhvd *n, int channel)
+{
+	if(channel < 0 || channel >= n->hardware_decoders_size)
+		return NHVD_ERROR_MSG("channel has to be index of hardware decoder");
+
+	atomic_store(&n->channel[channel].paused, 0);
+
+	return NHVD_OK;
+}
+
+//apply pause/resume requested since previous frame set, non-zero if paused
+static int nhvd_channel_paused(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	const int paused = atomic_load_explicit(&c->paused, memory_order_relaxed);
+
+	if(paused == c->decoding_paused)
+		return paused;
+
+	c->decoding_paused = paused;
+
+	//paused decoder releases its surfaces, resumed one starts from keyframe
+	if(paused)
+		nhvd_decode_channel(n, channel, NULL, 0);
+	else
+		c->wait_keyframe = 1;
+
+	return paused;
+}
+
+//drop channel packets until keyframe
+static void nhvd_wait_keyframe(struct nhvd *n, int channel)
+{
+	struct nhvd_frame *packet = &n->packet[channel];
+	int keyframe;
+
+	if(!packet->size)
+		return;
+
+	keyframe = nhvd_is_keyframe(n->channel[channel].codec, packet->data, packet->size);
+
+	//keyframes can't be detected for some codecs, resume immidiately
+	if(keyframe != 0)
+		n->channel[channel].wait_keyframe = 0;
+	else
+		packet->size = 0;
+}
+
+static int nhvd_feedback_init(struct nhvd *n, const struct nhvd_net_config *net_config)
+{
+	struct sockaddr_storage *address = &n->feedback_address;
+	int family;
+
+	if( (family = nhvd_address_parse(net_config->feedback_ip, address)) < 0)
+		return NHVD_ERROR_MSG("feedback_ip has to be IPv4 or IPv6 address");
+
+	if(family == AF_INET)
+	{
+		((struct sockaddr_in*)address)->sin_port = htons(net_config->feedback_port);
+		n->feedback_address_size = sizeof(struct sockaddr_in);
+	}
+	else
+	{
+		((struct sockaddr_in6*)address)->sin6_port = htons(net_config->feedback_port);
+		n->feedback_address_size = sizeof(struct sockaddr_in6);
+	}
+
+	if( (n->feedback_fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+		return NHVD_ERROR_MSG("failed to create keyframe requests socket");
+
+	n->feedback_interval_ns = 1000000LL *
+		(net_config->feedback_interval_ms ? net_config->feedback_interval_ms : NHVD_FEEDBACK_INTERVAL_MS);
+
+	return NHVD_OK;
+}
+
+#ifdef NHVD_MLSP_SOCKET
+
+//UDP socket for MLSP, options are applied before it receives anything
+static int nhvd_socket_init(struct nhvd *n, const struct nhvd_net_config *net_config)
+{
+	//socket bound to the group receives only the group
+	const char *ip = net_config->multicast_group ? net_config->multicast_group : net_config->ip;
+	struct sockaddr_storage address = {0};
+	int family = AF_INET, reuse = 1;
+	struct timespec stamp;
+
+	if(ip && (family = nhvd_address_parse(ip, &address)) < 0)
+		return NHVD_ERROR_MSG("ip and multicast_group have to be IPv4 or IPv6 address");
+
+	address.ss_family = family;
+
+	if(family == AF_INET)
+		((struct sockaddr_in*)&address)->sin_port = htons(net_config->port);
+	else
+		((struct sockaddr_in6*)&address)->sin6_port = htons(net_config->port);
+
+	if( (n->socket_fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+		return NHVD_ERROR_MSG("failed to create network socket");
+
+	//kernel doubles the value for bookkeeping, see socket_buffer_size in nhvd_stats for granted size
+	if(net_config->receive_buffer_size)
+	{
+		const int size = net_config->receive_buffer_size;
+
+		//SO_RCVBUFFORCE exceeds net.core.rmem_max with CAP_NET_ADMIN
+		if(setsockopt(n->socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0 &&
+			setsockopt(n->socket_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+			return NHVD_ERROR_MSG("failed to set receive_buffer_size");
+	}
+
+	if(net_config->busy_poll_us)
+		if(setsockopt(n->socket_fd, SOL_SOCKET, SO_BUSY_POLL, &net_config->busy_poll_us, sizeof(net_config->busy_poll_us)) != 0)
+			return NHVD_ERROR_MSG("failed to set busy_poll_us (requires CAP_NET_ADMIN)");
+
+	//other receivers of the group on this host bind the same address and port
+	if(net_config->multicast_group)
+		if(setsockopt(n->socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0)
+			return NHVD_ERROR_MSG("failed to set SO_REUSEADDR for multicast");
+
+	//validates the group before bind
+	if(net_config->multicast_group)
+		if(nhvd_multicast_join(n, net_config) != NHVD_OK)
+			return NHVD_ERROR;
+
+	if(bind(n->socket_fd, (struct sockaddr*)&address, family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) != 0)
+		return NHVD_ERROR_MSG("failed to bind network socket");
+
+	//MLSP receives without control messages so SO_TIMESTAMPNS is not an option,
+	//the first SIOCGSTAMPNS enables timestamping, later ones return the last datagram arrival
+	if(net_config->kernel_timestamps)
+		ioctl(n->socket_fd, SIOCGSTAMPNS, &stamp);
+
+	n->kernel_timestamps = net_config->kernel_timestamps;
+
+	return NHVD_OK;
+}
+
+//join (source-specific) multicast group with protocol independent RFC 3678 interface
+static int nhvd_multicast_join(struct nhvd *n, const struct nhvd_net_config *net_config)
+{
+	struct sockaddr_storage group, source;
+	const int family = nhvd_address_parse(net_config->multicast_group, &group);
+	const int level = family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+	unsigned int interface = 0;
+
+	if(family < 0 || (family == AF_INET && !IN_MULTICAST(ntohl(((struct sockaddr_in*)&group)->sin_addr.s_addr))) ||
+		(family == AF_INET6 && !IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6*)&group)->sin6_addr)))
+		return NHVD_ERROR_MSG("multicast_group has to be IPv4 or IPv6 multicast address");
+
+	if(net_config->multicast_source && nhvd_address_parse(net_config->multicast_source, &source) != family)
+		return NHVD_ERROR_MSG("multicast_source has to be address of the same family as multicast_group");
+
+	if(net_config->multicast_interface && (interface = if_nametoindex(net_config->multicast_interface)) == 0)
+		return NHVD_ERROR_MSG("failed to find multicast_interface");
+
+	if(net_config->multicast_source)
+	{
+		struct group_source_req request = {0};
+
+		request.gsr_interface = interface;
+		request.gsr_group = group;
+		request.gsr_source = source;
+
+		if(setsockopt(n->socket_fd, level, MCAST_JOIN_SOURCE_GROUP, &request, sizeof(request)) != 0)
+			return NHVD_ERROR_MSG("failed to join source-specific multicast group");
+
+		return NHVD_OK;
+	}
+
+	struct group_req request = {0};
+
+	request.gr_interface = interface;
+	request.gr_group = group;
+
+	if(setsockopt(n->socket_fd, level, MCAST_JOIN_GROUP, &request, sizeof(request)) != 0)
+		return NHVD_ERROR_MSG("failed to join multicast group");
+
+	return NHVD_OK;
+}
+
+#endif
+
+//IPv4 or IPv6 address, address family or -1
+static int nhvd_address_parse(const char *ip, struct sockaddr_storage *address)
+{
+	struct sockaddr_in *ipv4 = (struct sockaddr_in*)address;
+	struct sockaddr_in6 *ipv6 = (struct sockaddr_in6*)address;
+
+	memset(address, 0, sizeof(*address));
+
+	if(inet_pton(AF_INET, ip, &ipv4->sin_addr) == 1)
+		return ipv4->sin_family = AF_INET;
+
+	if(inet_pton(AF_INET6, ip, &ipv6->sin6_addr) == 1)
+		return ipv6->sin6_family = AF_INET6;
+
+	return -1;
+}
+
+//frame set arrival, kernel timestamp of the datagram that completed it if enabled
+static int64_t nhvd_received_ns(struct nhvd *n)
+{
+	const int64_t now = nhvd_time_ns();
+	struct timespec kernel, realtime;
+
+	if(!n->kernel_timestamps || ioctl(n->socket_fd, SIOCGSTAMPNS, &kernel) != 0)
+		return now;
+
+	//kernel timestamps are CLOCK_REALTIME, the library measures CLOCK_MONOTONIC
+	clock_gettime(CLOCK_REALTIME, &realtime);
+
+	const int64_t age = (realtime.tv_sec - kernel.tv_sec) * 1000000000LL + (realtime.tv_nsec - kernel.tv_nsec);
+
+	return age > 0 ? now - age : now;
+}
+
+//CPU affinity and real-time scheduling of library thread
+static int nhvd_thread_tune(struct nhvd *n, pthread_t thread, uint64_t cpus)
+{
+	if(cpus)
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+
+		for(int cpu=0;cpu<64;++cpu)
+			if(cpus & (1ULL << cpu))
+				CPU_SET(cpu, &set);
+
+		if(pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+			return NHVD_ERROR_MSG("failed to set thread CPU affinity");
+	}
+
+	if(n->realtime_policy != NHVD_SCHED_OTHER)
+	{
+		const int policy = n->realtime_policy == NHVD_SCHED_FIFO ? SCHED_FIFO : SCHED_RR;
+		struct sched_param param = {0};
+
+		param.sched_priority = n->realtime_priority;
+
+		if(pthread_setschedparam(thread, policy, &param) != 0)
+			return NHVD_ERROR_MSG("failed to set real-time scheduling (requires CAP_SYS_NICE or RLIMIT_RTPRIO)");
+	}
+
+	return NHVD_OK;
+}
+
+//detect loss before decoding, H.264 reference frames have consecutive frame_num
+static void nhvd_track_references(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	const struct nhvd_frame *packet = &n->packet[channel];
+	const uint8_t *nal;
+	int keyframe, frame_num;
+
+	if(!packet->size)
+		return;
+
+	//keyframe ends the loss, without keyframe detection assume it does
+	if( (keyframe = nhvd_is_keyframe(c->codec, packet->data, packet->size)) != 0)
+		c->keyframe_needed = 0;
+
+	if(c->codec != NHVD_CODEC_H264 || !c->sps_valid)
+		return;
+
+	if( (nal = nhvd_first_vcl(c->codec, packet->data, packet->size)) == NULL)
+		return;
+
+	//start code of the first slice
+	if(nhvd_parse_frame_num(nal - 3, packet->size - (nal - 3 - packet->data), &c->sps, &frame_num) != 1)
+		return;
+
+	//the same frame_num (e.g. second field) or the next one, IDR starts from 0
+	if(keyframe != 1 && c->frame_num >= 0 && frame_num != c->frame_num &&
+		frame_num != (c->frame_num + 1) % (1 << c->sps.log2_max_frame_num))
+		nhvd_reference_lost(n, channel);
+
+	if(nal[0] >> 5) //nal_ref_idc
+		c->frame_num = frame_num;
+}
+
+//the channel can't decode correctly until keyframe
+static void nhvd_reference_lost(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+
+	//errors propagate until keyframe, count once
+	if(!c->keyframe_needed)
+		++n->counters[channel].reference_losses;
+
+	c->keyframe_needed = 1;
+}
+
+//after decoding, decoder errors are also known
+static void nhvd_request_keyframes(struct nhvd *n)
+{
+	for(int i=0;i<n->hardware_decoders_size;++i)
+	{
+		const struct nhvd_channel *c = &n->channel[i];
+
+		if(!c->decoding_paused && (c->keyframe_needed || c->wait_keyframe))
+			nhvd_request_keyframe(n, i);
+	}
+}
+
+//best effort, lost requests are repeated after feedback interval
+static void nhvd_request_keyframe(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	struct nhvd_keyframe_request request;
+	const int64_t now = nhvd_time_ns();
+
+	if(c->keyframe_request_ns && now - c->keyframe_request_ns < n->feedback_interval_ns)
+		return;
+
+	c->keyframe_request_ns = now;
+
+	memcpy(request.magic, NHVD_KEYFRAME_REQUEST_MAGIC, sizeof(request.magic));
+	request.channel = htons(channel);
+	request.sequence = htons(n->feedback_sequence++);
+
+	if(sendto(n->feedback_fd, &request, sizeof(request), MSG_DONTWAIT,
+		(const struct sockaddr*)&n->feedback_address, n->feedback_address_size) == sizeof(request))
+		++n->counters[channel].keyframe_requests;
+}
+
+static int nhvd_is_keyframe_set(struct nhvd *n, const struct nhvd_queue_entry *entry)
+{
+	int keyframes = 0;
+
+	for(int i=0;i<n->hardware_decoders_size;++i)
+	{
+		const struct nhvd_buffer *buffer = &entry->buffer[i];
+
+		if(!buffer->size)
+			continue;
+
+		switch(nhvd_is_keyframe(n->channel[i].codec, buffer->ref->data, buffer->size))
+		{
+			case 0:
+				return 0;
+			case 1:
+				++keyframes;
+		}
+	}
+
+	return keyframes > 0;
+}
+
+static int nhvd_codec(const char *codec)
+{
+	if(codec == NULL)
+		return NHVD_CODEC_OTHER;
+	if(strncmp(codec, "h264", 4) == 0)
+		return NHVD_CODEC_H264;
+	if(strncmp(codec, "hevc", 4) == 0)
+		return NHVD_CODEC_HEVC;
+	if(strncmp(codec, "vp8", 3) == 0)
+		return NHVD_CODEC_VP8;
+
+	return NHVD_CODEC_OTHER;
+}
+
+//1 if keyframe, 0 if not, -1 if keyframes can't be detected for codec
+static int nhvd_is_keyframe(int codec, const uint8_t *data, int size)
+{
+	const uint8_t *nal;
+
+	if(codec == NHVD_CODEC_VP8) //frame tag, bit 0 - frame type
+		return !(data[0] & 0x01);
+
+	if(codec != NHVD_CODEC_H264 && codec != NHVD_CODEC_HEVC)
+		return -1;
+
+	//the first VCL NAL unit decides
+	if( (nal = nhvd_first_vcl(codec, data, size)) == NULL)
+		return 0;
+
+	if(codec == NHVD_CODEC_H264)
+		return (nal[0] & 0x1F) == 5; //IDR
+
+	const int type = (nal[0] >> 1) & 0x3F;
+
+	return type >= 16 && type <= 23; //IRAP (BLA, IDR, CRA)
+}
+
+//0 if frame is not used for reference, 1 if it is or it can't be detected
+static int nhvd_is_reference(int codec, const uint8_t *data, int size)
+{
+	const uint8_t *nal;
+
+	if(codec != NHVD_CODEC_H264 && codec != NHVD_CODEC_HEVC)
+		return 1;
+
+	if( (nal = nhvd_first_vcl(codec, data, size)) == NULL)
+		return 1;
+
+	if(codec == NHVD_CODEC_H264)
+		return (nal[0] >> 5) != 0; //nal_ref_idc
+
+	//sub-layer non-reference (TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N, reserved)
+	//safe with single temporal layer which is what hardware encoders produce
+	const int type = (nal[0] >> 1) & 0x3F;
+
+	return type > 14 || (type & 1);
+}
+
+//Annex B, header of the first VCL NAL unit or NULL
+static const uint8_t *nhvd_first_vcl(int codec, const uint8_t *data, int size)
+{
+	for(int i=0;i + 3 < size;++i)
+	{
+		if(data[i] || data[i+1] || data[i+2] != 1)
+			continue;
+
+		if(codec == NHVD_CODEC_H264)
+		{
+			const int type = data[i+3] & 0x1F;
+
+			if(type >= 1 && type <= 5) //coded slice
+				return data + i + 3;
+		}
+		else if( ((data[i+3] >> 1) & 0x3F) <= 31) //VCL
+			return data + i + 3;
+
+		i += 2;
+	}
+
+	return NULL;
+}
+
+static void *nhvd_network_thread(void *arg)
+{
+	struct nhvd *n = (struct nhvd*)arg;
+	const int channels = n->hardware_decoders_size + n->auxiliary_channels_size;
+	const struct mlsp_frame *streamer_frame;
+	int status;
+
+	while(atomic_load(&n->keep_working))
+	{
+		if( (status = nhvd_source_receive(n, &streamer_frame)) != NHVD_OK)
+		{
+			if(status == NHVD_TIMEOUT)
+			{
+				nhvd_queue_push(&n->queue, NULL, channels, NHVD_TIMEOUT, nhvd_time_ns());
+				continue;
+			}
+
+			atomic_store(&n->network_error, 1);
+			//wake up poll/epoll user to notice the error
+			nhvd_queue_signal(&n->queue);
+			break;
+		}
+
+		atomic_fetch_add(&n->queue.received, 1);
+
+		//replay as fast as possible doesn't drop, it waits for decoding
+		while(n->replay.file && !n->replay.timing && nhvd_queue_full(&n->queue) && atomic_load(&n->keep_working))
+			usleep(1000);
+
+		if(nhvd_queue_push(&n->queue, streamer_frame, channels, NHVD_OK, nhvd_received_ns(n)) != NHVD_OK)
+		{
+			atomic_fetch_add(&n->queue.dropped, 1);
+
+			if(n->recorder)
+				nhvd_capture_dropped(n, streamer_frame);
+
+			continue;
+		}
+
+		//reference the data just queued, no copy
+		if(n->recorder)
+		{
+			const struct nhvd_queue_entry *entry = &n->queue.entry[(atomic_load(&n->queue.head) - 1) % n->queue.size];
+
+			for(int i=0;i<channels;++i)
+				nhvd_buffer_frame(&entry->buffer[i], &n->capture_frame[i]);
+
+			nhvd_recorder_push(n->recorder, n->capture_frame, entry->received_ns);
+		}
+	}
+
+	return NULL;
+}
+
+//called only from network thread, copies the frame set to the queue
+static int nhvd_queue_push(struct nhvd_queue *q, const struct mlsp_frame *frame, int channels, int status, int64_t received_ns)
+{
+	const unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	const unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	struct nhvd_queue_entry *entry = &q->entry[head % q->size];
+
+	if(head - tail >= q->size)
+		return NHVD_ERROR; //full, decoding doesn't keep up
+
+	entry->status = status;
+	entry->received_ns = received_ns;
+
+	for(int i=0;i<channels;++i)
+	{
+		struct nhvd_buffer *buffer = &entry->buffer[i];
+		const int size = frame ? frame[i].size : 0;
+
+		//the user or decoder may still reference the old buffer
+		av_buffer_unref(&buffer->ref);
+		buffer->size = 0;
+
+		if(!size)
+			continue;
+
+		//the only copy, MLSP reuses its reassembly buffers
+		if( (buffer->ref = nhvd_pool_buffer(&q->pool[i], &q->pool_size[i], size)) == NULL)
+			return NHVD_ERROR;
+
+		memcpy(buffer->ref->data, frame[i].data, size);
+		//libavcodec may read past the end of data
+		memset(buffer->ref->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+		buffer->size = size;
+	}
+
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	sem_post(&q->ready);
+	nhvd_queue_signal(q);
+
+	return NHVD_OK;
+}
+
+static void nhvd_queue_signal(struct nhvd_queue *q)
+{
+	const uint64_t event = 1;
+
+	while(write(q->event_fd, &event, sizeof(event)) < 0 && errno == EINTR)
+		;
+}
+
+//the captured traffic includes frame sets that didn't fit in receive queue
+static void nhvd_capture_dropped(struct nhvd *n, const struct mlsp_frame *frame)
+{
+	for(int i=0;i < n->hardware_decoders_size + n->auxiliary_channels_size;++i)
+	{
+		struct nhvd_frame raw = {frame[i].data, frame[i].size, NULL};
+		n->capture_frame[i] = raw;
+	}
+
+	nhvd_recorder_push(n->recorder, n->capture_frame, nhvd_time_ns());
+}
+
+static int nhvd_queue_full(struct nhvd_queue *q)
+{
+	const unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	const unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	return head - tail >= q->size;
+}
+
+//pooled buffer for size bytes and padding, pool is recreated when frames grow
+static AVBufferRef *nhvd_pool_buffer(AVBufferPool **pool, int *pool_size, int size)
+{
+	const int required = size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+	if(*pool_size < required)
+	{
+		//the old pool is freed when its last buffer is returned
+		av_buffer_pool_uninit(pool);
+		//headroom for bitrate fluctuations
+		*pool_size = required + required / 2;
+
+		if( (*pool = av_buffer_pool_init(*pool_size, av_buffer_alloc)) == NULL)
+		{
+			*pool_size = 0;
+			return NULL;
+		}
+	}
+
+	return av_buffer_pool_get(*pool);
+}
+
+static void nhvd_buffer_frame(const struct nhvd_buffer *buffer, struct nhvd_frame *frame)
+{
+	frame->data = buffer->ref ? buffer->ref->data : NULL;
+	frame->size = buffer->size;
+	frame->buf = buffer->ref;
+}
+
+static int nhvd_queue_init(struct nhvd_queue *q, int size, int channels)
+{
+	q->size = size + 1;
+
+	if(sem_init(&q->ready, 0, 0) != 0)
+		return NHVD_ERROR_MSG("failed to initialize receive queue semaphore");
+
+	q->ready_initialized = 1;
+
+	if( (q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		return NHVD_ERROR_MSG("failed to create receive queue event file descriptor");
+
+	if( (q->entry = (struct nhvd_queue_entry*)calloc(q->size, sizeof(struct nhvd_queue_entry))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for receive queue");
+
+	for(unsigned int i=0;i<q->size;++i)
+		if( (q->entry[i].buffer = (struct nhvd_buffer*)calloc(channels, sizeof(struct nhvd_buffer))) == NULL)
+			return NHVD_ERROR_MSG("not enough memory for receive queue");
+
+	if( (q->pool = (AVBufferPool**)calloc(channels, sizeof(AVBufferPool*))) == NULL ||
+		(q->pool_size = (int*)calloc(channels, sizeof(int))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for receive queue");
+
+	return NHVD_OK;
+}
+
+static void nhvd_queue_close(struct nhvd_queue *q, int channels)
+{
+	if(q->ready_initialized)
+		sem_destroy(&q->ready);
+
+	q->ready_initialized = 0;
+
+	if(q->event_fd != -1)
+		close(q->event_fd);
+
+	q->event_fd = -1;
+
+	for(int c=0;q->pool && c<channels;++c)
+		av_buffer_pool_uninit(&q->pool[c]);
+
+	free(q->pool);
+	free(q->pool_size);
+	q->pool = NULL;
+	q->pool_size = NULL;
+
+	if(q->entry == NULL)
+		return;
+
+	for(unsigned int i=0;i<q->size;++i)
+	{
+		for(int c=0;q->entry[i].buffer && c<channels;++c)
+			av_buffer_unref(&q->entry[i].buffer[c].ref);
+
+		free(q->entry[i].buffer);
+	}
+
+	free(q->entry);
+	q->entry = NULL;
+}
+
+//NULL packet to flush all hardware decoders, convert 0 for frames that are not returned
+static int nhvd_decode_frame(struct nhvd *n, struct nhvd_frame *packet, int convert)
+{
+	int error = 0;
+
+	if(n->decoder_worker)
+		return nhvd_decode_frame_parallel(n, packet, convert);
+
+	for(int i=0;i<n->hardware_decoders_size;++i)
+		n->channel[i].frame = NULL;
+
+	//special NULL packet case with flush request
+	for(int i=0;!packet && i < n->hardware_decoders_size;++i)
+		if(nhvd_send_packet(n, i, NULL) != HVD_OK)
+			return NHVD_ERROR_MSG("error during decoding (flush)");
+
+	//send data to all hardware decoders
+	for(int i=0;packet && i < n->hardware_decoders_size;++i)
+	{
+		if(!packet[i].size) //silently skip empty subframes
+			continue; //(e.g. different framerates/B frames)
+
+		if(nhvd_send_packet(n, i, &packet[i]) != HVD_OK)
+			return NHVD_ERROR_MSG("error during decoding");
+	}
+
+	//receive data from all hardware decoders
+	for(int i=0;i<n->hardware_decoders_size;++i)
+	{
+		if(packet && !packet[i].size) //silently skip empty subframes
+			continue; //(e.g. different framerates/B frames)
+
+		//non NULL packet - get single frame
+		//NULL packet - flush the decoder, work until hardware is flushed
+		do
+			n->channel[i].frame = nhvd_receive_frame(n, i, &error);
+		while(!packet && n->channel[i].frame);
+
+		if(error != NHVD_OK)
+			return NHVD_ERROR_MSG("error after decoding");
+
+		if(convert && nhvd_convert_frame(n, i) != NHVD_OK)
+			return NHVD_ERROR;
+	}
+
+	return NHVD_OK;
+}
+
+//the same as nhvd_decode_frame but each channel is decoded on its own thread
+static int nhvd_decode_frame_parallel(struct nhvd *n, struct nhvd_frame *packet, int convert)
+{
+	int status = NHVD_OK;
+
+	for(int i=1;i<n->hardware_decoders_size;++i)
+	{
+		struct nhvd_decoder_worker *w = &n->decoder_worker[i];
+
+		pthread_mutex_lock(&w->mutex);
+		w->packet = packet ? &packet[i] : NULL;
+		w->convert = convert;
+		w->job = 1;
+		pthread_cond_signal(&w->work);
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	//caller thread drives the first decoder
+	if(nhvd_decode_channel(n, 0, packet, convert) != NHVD_OK)
+		status = NHVD_ERROR;
+
+	for(int i=1;i<n->hardware_decoders_size;++i)
+	{
+		struct nhvd_decoder_worker *w = &n->decoder_worker[i];
+
+		pthread_mutex_lock(&w->mutex);
+		while(w->job)
+			pthread_cond_wait(&w->done, &w->mutex);
+		if(w->status != NHVD_OK)
+			status = NHVD_ERROR;
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	return status;
+}
+
+//NULL packet to flush the hardware decoder, convert 0 for frames that are not returned
+static int nhvd_decode_channel(struct nhvd *n, int channel, struct nhvd_frame *packet, int convert)
+{
+	int error = 0;
+
+	n->channel[channel].frame = NULL;
+
+	if(packet && !packet->size) //silently skip empty subframes
+		return NHVD_OK; //(e.g. different framerates/B frames)
+
+	if(nhvd_send_packet(n, channel, packet) != HVD_OK)
+		return NHVD_ERROR_MSG(packet ? "error during decoding" : "error during decoding (flush)");
+
+	//non NULL packet - get single frame
+	//NULL packet - flush the decoder, work until hardware is flushed
+	do
+		n->channel[channel].frame = nhvd_receive_frame(n, channel, &error);
+	while(!packet && n->channel[channel].frame);
+
+	if(error != NHVD_OK)
+		return NHVD_ERROR_MSG("error after decoding");
+
+	//with parallel decoding converted on the worker thread too
+	return convert ? nhvd_convert_frame(n, channel) : NHVD_OK;
+}
+
+//to output_format if decoder returned different format
+static int nhvd_convert_frame(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+
+	if(!c->converter || !c->frame)
+		return NHVD_OK;
+
+	if( (c->frame = nhvd_converter_convert(c->converter, c->frame)) == NULL)
+		return NHVD_ERROR_MSG("error during color conversion");
+
+	return NHVD_OK;
+}
+
+//dispatch to hardware or software decoder, NULL packet to flush
+static int nhvd_send_packet(struct nhvd *n, int channel, struct nhvd_frame *packet)
+{
+	struct hvd_packet hvd_packet;
+
+	if(packet)
+		n->channel[channel].send_ns = nhvd_time_ns();
+
+	//lazily initialized decoder that didn't see its stream yet
+	if(!n->channel[channel].software_decoder && !n->channel[channel].hardware_decoder)
+		return HVD_OK;
+
+	if(n->channel[channel].software_decoder)
+		return nhvd_sw_send_packet(n->channel[channel].software_decoder, packet);
+
+	if(!packet)
+		return hvd_send_packet(n->channel[channel].hardware_decoder, NULL);
+
+	hvd_packet.data = packet->data;
+	hvd_packet.size = packet->size;
+
+	return hvd_send_packet(n->channel[channel].hardware_decoder, &hvd_packet);
+}
+
+static AVFrame *nhvd_receive_frame(struct nhvd *n, int channel, int *error)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	AVFrame *frame;
+
+	if(c->software_decoder)
+		frame = nhvd_sw_receive_frame(c->software_decoder, error);
+	else if(c->hardware_decoder)
+		frame = hvd_receive_frame(c->hardware_decoder, error);
+	else
+		frame = NULL, *error = HVD_OK;
+
+	if(frame)
+		c->decoded_ns = nhvd_time_ns();
+
+	//concealed errors, e.g. missing reference
+	if(frame && (frame->decode_error_flags || (frame->flags & AV_FRAME_FLAG_CORRUPT)))
+		nhvd_reference_lost(n, channel);
+
+	return frame;
+}
+
+static int nhvd_is_software(const char *hardware)
+{
+	return hardware == NULL || hardware[0] == '\0' || strcmp(hardware, "none") == 0;
+}
+
+//decoders may be created after nhvd_init returns, keep own copy of strings
+static int nhvd_config_copy(struct nhvd_hw_config *dst, const struct nhvd_hw_config *src)
+{
+	const char **strings[] = {&dst->hardware, &dst->codec, &dst->device, &dst->pixel_format, &dst->output_format};
+
+	*dst = *src;
+
+	for(unsigned int i=0;i<sizeof(strings) / sizeof(strings[0]);++i)
+		if(*strings[i] && (*strings[i] = strdup(*strings[i])) == NULL)
+		{
+			//the rest still points to src
+			for(unsigned int j=i;j<sizeof(strings) / sizeof(strings[0]);++j)
+				*strings[j] = NULL;
+
+			return NHVD_ERROR;
+		}
+
+	return NHVD_OK;
+}
+
+static void nhvd_config_free(struct nhvd_hw_config *config)
+{
+	free((char*)config->hardware);
+	free((char*)config->codec);
+	free((char*)config->device);
+	free((char*)config->pixel_format);
+	free((char*)config->output_format);
+}
+
+//hardware or software decoder from channel configuration
+static int nhvd_decoder_init(struct nhvd_channel *c)
+{
+	const struct nhvd_hw_config *config = &c->config;
+	struct hvd_config hvd_cfg={config->hardware, config->codec, config->device,
+	config->pixel_format, config->width, config->height, config->profile};
+
+	if(nhvd_is_software(config->hardware))
+	{
+		if( (c->software_decoder = nhvd_sw_init(config, c->threads)) == NULL )
+			return NHVD_ERROR_MSG("failed to initalize software decoder");
+
+		return NHVD_OK;
+	}
+
+	if( (c->hardware_decoder = hvd_init(&hvd_cfg)) == NULL )
+		return NHVD_ERROR_MSG("failed to initalize hardware decoder");
+
+	return NHVD_OK;
+}
+
+static int nhvd_decoders_init_parallel(struct nhvd *n)
+{
+	const int hw_size = n->hardware_decoders_size;
+	pthread_t thread[hw_size];
+	int created[hw_size], status = NHVD_OK;
+
+	for(int i=0;i<hw_size;++i)
+		created[i] = pthread_create(&thread[i], NULL, nhvd_decoder_init_thread, &n->channel[i]) == 0;
+
+	for(int i=0;i<hw_size;++i)
+	{
+		void *thread_status = NULL;
+
+		//without thread initialize on this one
+		if(created[i])
+			pthread_join(thread[i], &thread_status);
+		else
+			thread_status = nhvd_decoder_init_thread(&n->channel[i]);
+
+		if(thread_status != NULL)
+			status = NHVD_ERROR;
+	}
+
+	return status;
+}
+
+//NULL on success
+static void *nhvd_decoder_init_thread(void *arg)
+{
+	struct nhvd_channel *c = (struct nhvd_channel*)arg;
+
+	return nhvd_decoder_init(c) == NHVD_OK ? NULL : arg;
+}
+
+//track stream parameters of the packet channel
+//- lazily create decoder on the first packet, H.264 and HEVC with parameters from SPS
+//- rebuild only this channel decoder when SPS changes (e.g. resolution, profile)
+static int nhvd_channel_configure(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+	const struct nhvd_frame *packet = &n->packet[channel];
+	const int has_decoder = c->software_decoder || c->hardware_decoder;
+	const struct nhvd_sps previous = c->sps;
+	int parsed = 0;
+
+	if(c->codec == NHVD_CODEC_H264 || c->codec == NHVD_CODEC_HEVC)
+		//parameter sets precede picture data, only packet headers are scanned
+		if( (parsed = nhvd_parse_sps(c->codec == NHVD_CODEC_HEVC, packet->data, packet->size, &c->sps)) < 0)
+		{
+			c->sps = previous; //let the decoder deal with it
+			fprintf(stderr, "nhvd: failed to parse SPS of channel %d\n", channel);
+		}
+
+	if(parsed == 1)
+	{
+		c->config.width = c->sps.width;
+		c->config.height = c->sps.height;
+		c->config.profile = c->sps.profile;
+	}
+
+	if(!has_decoder)
+	{
+		//the first packet of lazily initialized H.264/HEVC channel has to carry SPS
+		if(!parsed && (c->codec == NHVD_CODEC_H264 || c->codec == NHVD_CODEC_HEVC))
+			return NHVD_NO_SPS;
+
+		c->sps_valid = parsed == 1;
+
+		return nhvd_decoder_init(c);
+	}
+
+	if(parsed != 1)
+		return NHVD_OK;
+
+	if(!c->sps_valid || (previous.width == c->sps.width && previous.height == c->sps.height &&
+		previous.profile == c->sps.profile && previous.bit_depth == c->sps.bit_depth &&
+		previous.chroma_format == c->sps.chroma_format))
+	{
+		c->sps_valid = 1;
+		return NHVD_OK;
+	}
+
+	return nhvd_decoder_rebuild(n, channel);
+}
+
+//new decoder for changed stream parameters, other channels are not affected
+static int nhvd_decoder_rebuild(struct nhvd *n, int channel)
+{
+	struct nhvd_channel *c = &n->channel[channel];
+
+	//frames of the previous sequence are not returned
+	nhvd_decode_channel(n, channel, NULL, 0);
+
+	hvd_close(c->hardware_decoder);
+	nhvd_sw_close(c->software_decoder);
+	c->hardware_decoder = NULL;
+	c->software_decoder = NULL;
+
+	++n->counters[channel].reconfigured;
+
+	return nhvd_decoder_init(c);
+}
+
+//explicit per channel thread count or equal share of software_threads
+static int nhvd_software_threads(const struct nhvd_net_config *net_config,
+	const struct nhvd_hw_config *hw_config, int hw_size, int channel)
+{
+	int threads = net_config->software_threads;
+	int shared_channels = 0;
+
+	if(hw_config[channel].threads > 0)
+		return hw_config[channel].threads;
+
+	if(threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for(int i=0;i<hw_size;++i)
+		if(nhvd_is_software(hw_config[i].hardware))
+		{
+			if(hw_config[i].threads > 0)
+				threads -= hw_config[i].threads;
+			else
+				++shared_channels;
+		}
+
+	threads = threads / shared_channels;
+
+	return threads > 0 ? threads : 1;
+}
+
+static struct nhvd_sw_decoder *nhvd_sw_init(const struct nhvd_hw_config *config, int threads)
+{
+	struct nhvd_sw_decoder *s, zero_sw = {0};
+	const AVCodec *codec;
+
+	if( (s = (struct nhvd_sw_decoder*)malloc(sizeof(struct nhvd_sw_decoder))) == NULL )
+		return nhvd_sw_close_and_return_null(NULL, "not enough memory for software decoder");
+
+	*s = zero_sw;
+
+	if( (codec = avcodec_find_decoder_by_name(config->codec)) == NULL )
+		return nhvd_sw_close_and_return_null(s, "software decoder not found");
+
+	if( (s->decoder_ctx = avcodec_alloc_context3(codec)) == NULL ||
+		(s->frame = av_frame_alloc()) == NULL ||
+		(s->packet = av_packet_alloc()) == NULL )
+		return nhvd_sw_close_and_return_null(s, "not enough memory for software decoder");
+
+	if(config->lowres < 0 || config->lowres > codec->max_lowres)
+		return nhvd_sw_close_and_return_null(s, "lowres not supported by software decoder");
+
+	if(config->skip_loop_filter < NHVD_SKIP_NONE || config->skip_loop_filter > NHVD_SKIP_ALL)
+		return nhvd_sw_close_and_return_null(s, "skip_loop_filter has to be NHVD_SKIP_NONE, NHVD_SKIP_NONREF or NHVD_SKIP_ALL");
+
+	s->decoder_ctx->width = config->width;
+	s->decoder_ctx->height = config->height;
+	s->decoder_ctx->profile = config->profile ? config->profile : FF_PROFILE_UNKNOWN;
+
+	//quality for speed, the decoder output is not bit exact anymore
+	s->decoder_ctx->skip_loop_filter = config->skip_loop_filter == NHVD_SKIP_ALL ? AVDISCARD_ALL :
+		config->skip_loop_filter == NHVD_SKIP_NONREF ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	s->decoder_ctx->skip_frame = s->skip_frame = config->skip_nonref ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	s->decoder_ctx->lowres = config->lowres;
+
+	//slice threading doesn't delay output, frame threading delays by threads - 1 frames
+	s->decoder_ctx->thread_count = threads;
+	s->decoder_ctx->thread_type = config->frame_threading && !config->low_delay ? FF_THREAD_FRAME | FF_THREAD_SLICE : FF_THREAD_SLICE;
+
+	if(config->low_delay)
+		s->decoder_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+	if(avcodec_open2(s->decoder_ctx, codec, NULL) < 0)
+		return nhvd_sw_close_and_return_null(s, "failed to open software decoder");
+
+	return s;
+}
+
+static void nhvd_sw_close(struct nhvd_sw_decoder *s)
+{
+	if(s == NULL)
+		return;
+
+	av_packet_free(&s->packet);
+	av_frame_free(&s->frame);
+	avcodec_free_context(&s->decoder_ctx);
+
+	free(s);
+}
+
+static struct nhvd_sw_decoder *nhvd_sw_close_and_return_null(struct nhvd_sw_decoder *s, const char *msg)
+{
+	if(msg)
+		fprintf(stderr, "nhvd: %s\n", msg);
+
+	nhvd_sw_close(s);
+
+	return NULL;
+}
+
+static int nhvd_sw_send_packet(struct nhvd_sw_decoder *s, struct nhvd_frame *packet)
+{
+	int ret;
+
+	//NULL packet puts decoder in draining mode
+	if(packet)
+	{
+		s->packet->data = packet->data;
+		s->packet->size = packet->size;
+		//borrowed, libavcodec takes its own reference instead of copying
+		s->packet->buf = packet->buf;
+	}
+
+	ret = avcodec_send_packet(s->decoder_ctx, packet ? s->packet : NULL);
+
+	s->packet->buf = NULL;
+
+	return ret < 0 ? HVD_ERROR : HVD_OK;
+}
+
+static AVFrame *nhvd_sw_receive_frame(struct nhvd_sw_decoder *s, int *error)
+{
+	int ret = avcodec_receive_frame(s->decoder_ctx, s->frame);
+
+	*error = HVD_OK;
+
+	if(ret == AVERROR_EOF) //drained, prepare for new streaming sequence
+	{
+		avcodec_flush_buffers(s->decoder_ctx);
+		return NULL;
+	}
+
+	if(ret == AVERROR(EAGAIN))
+		return NULL;
+
+	if(ret < 0)
+	{
+		*error = HVD_ERROR;
+		return NULL;
+	}
+
+	return s->frame;
+}
+
+static int nhvd_decoder_workers_init(struct nhvd *n)
+{
+	if( (n->decoder_worker = (struct nhvd_decoder_worker*)nhvd_aligned_calloc(n->hardware_decoders_size, sizeof(struct nhvd_decoder_worker))) == NULL)
+		return NHVD_ERROR_MSG("not enough memory for decoder workers");
+
+	for(int i=1;i<n->hardware_decoders_size;++i)
+	{
+		struct nhvd_decoder_worker *w = &n->decoder_worker[i];
+
+		w->n = n;
+		w->channel = i;
+		w->keep_working = 1;
+
+		if(pthread_mutex_init(&w->mutex, NULL) != 0)
+			return NHVD_ERROR_MSG("failed to initialize decoder worker mutex");
+
+		if(pthread_cond_init(&w->work, NULL) != 0)
+		{
+			pthread_mutex_destroy(&w->mutex);
+			return NHVD_ERROR_MSG("failed to initialize decoder worker condition");
+		}
+
+		if(pthread_cond_init(&w->done, NULL) != 0)
+		{
+			pthread_cond_destroy(&w->work);
+			pthread_mutex_destroy(&w->mutex);
+			return NHVD_ERROR_MSG("failed to initialize decoder worker condition");
+		}
+
+		w->initialized = 1;
+
+		if(pthread_create(&w->thread, NULL, nhvd_decoder_thread, w) != 0)
+			return NHVD_ERROR_MSG("failed to create decoder worker thread");
+
+		w->running = 1;
+
+		if(nhvd_thread_tune(n, w->thread, n->decoding_cpus) != NHVD_OK)
+			return NHVD_ERROR;
+	}
+
+	return NHVD_OK;
+}
+
+static void nhvd_decoder_workers_close(struct nhvd *n)
+{
+	if(n->decoder_worker == NULL)
+		return;
+
+	for(int i=1;i<n->hardware_decoders_size;++i)
+	{
+		struct nhvd_decoder_worker *w = &n->decoder_worker[i];
+
+		if(w->running)
+		{
+			pthread_mutex_lock(&w->mutex);
+			w->keep_working = 0;
+			pthread_cond_signal(&w->work);
+			pthread_mutex_unlock(&w->mutex);
+
+			pthread_join(w->thread, NULL);
+		}
+
+		if(w->initialized)
+		{
+			pthread_cond_destroy(&w->done);
+			pthread_cond_destroy(&w->work);
+			pthread_mutex_destroy(&w->mutex);
+		}
+	}
+
+	free(n->decoder_worker);
+	n->decoder_worker = NULL;
+}
+
+static void *nhvd_decoder_thread(void *arg)
+{
+	struct nhvd_decoder_worker *w = (struct nhvd_decoder_worker*)arg;
+	int status;
+
+	pthread_mutex_lock(&w->mutex);
+
+	while(1)
+	{
+		while(!w->job && w->keep_working)
+			pthread_cond_wait(&w->work, &w->mutex);
+
+		if(!w->keep_working)
+			break;
+
+		pthread_mutex_unlock(&w->mutex);
+		status = nhvd_decode_channel(w->n, w->channel, w->packet, w->convert);
+		pthread_mutex_lock(&w->mutex);
+
+		w->status = status;
+		w->job = 0;
+		pthread_cond_signal(&w->done);
+	}
+
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+//zeroed cache line aligned array, size has to be multiple of NHVD_CACHE_LINE
+static void *nhvd_aligned_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if(nmemb == 0)
+		nmemb = 1;
+
+	if( (p = aligned_alloc(NHVD_CACHE_LINE, nmemb * size)) == NULL)
+		return NULL;
+
+	return memset(p, 0, nmemb * size);
+}
+
 static struct nhvd *nhvd_close_and_return_null(struct nhvd *n, const char *msg)
 {
 	if(msg)
@@ -31,8 +31,9 @@
 extern "C" {
 #endif
 
-//we expose FFmpeg AVFrame type
+//we expose FFmpeg AVFrame and AVBufferRef types
 #include <libavutil/frame.h>
+#include <libavutil/buffer.h>
 
 /** \addtogroup interface Public interface
  *  @{
@@ -40,7 +41,8 @@ extern "C" {
 
 enum NHVD_COMPILE_TIME_CONSTANTS
 {
-	NHVD_MAX_DECODERS = 3, //!< max number of decoders in multi decoding
+	NHVD_MAX_CHANNELS = 3, //!< max number of channels (hw_size + aux_size), MLSP subframes limit
+	NHVD_MAX_DECODERS = NHVD_MAX_CHANNELS, //!< deprecated, use NHVD_MAX_CHANNELS
 };
 
 /**
@@ -61,9 +63,34 @@ struct nhvd;
  */
 struct nhvd_net_config
 {
-	const char *ip; //!< IP (to listen on) or NULL (listen on any)
+	const char *ip; //!< IP (to listen on) or NULL (listen on any IPv4), IPv6 with NHVD_MLSP_SOCKET
 	uint16_t port; //!< server port
 	int timeout_ms; //!< 0 ar positive number
+	int receive_queue_size; //!< 0 to receive on caller thread or number of frame sets queued by network thread
+	int parallel_decoding; //!< 0 to decode channels one after another, non-zero to decode each channel on its own thread
+	int software_threads; //!< 0 for all available cores or total number of threads shared by software decoders
+	int max_backlog; //!< 0 to process all frame sets or number of frame sets waiting in queue that triggers skipping to the freshest
+	int backlog_policy; //!< NHVD_BACKLOG_KEYFRAME or NHVD_BACKLOG_DECODE
+	const char *capture_file; //!< NULL or file to record received frame sets to
+	const char *replay_file; //!< NULL to receive from network or capture file replayed instead
+	int replay_timing; //!< 0 replays as fast as possible, non-zero with original timing
+	int capture_queue_size; //!< 0 for default or number of frame sets waiting for writing before capture drops
+	int timeout_policy; //!< NHVD_TIMEOUT_FLUSH, NHVD_TIMEOUT_KEEP or NHVD_TIMEOUT_LAZY
+	int jitter_buffer_ms; //!< 0 to disable or maximum latency added by adaptive jitter buffer
+	int decoder_init; //!< NHVD_INIT_SEQUENTIAL, NHVD_INIT_PARALLEL or NHVD_INIT_LAZY
+	const char *feedback_ip; //!< NULL to disable or IPv4/IPv6 address of the sender listening for keyframe requests
+	uint16_t feedback_port; //!< sender port listening for keyframe requests
+	int feedback_interval_ms; //!< 0 for default (100 ms) or minimum interval between keyframe requests of channel
+	int receive_buffer_size; //!< 0 for system default or socket receive buffer size in bytes (SO_RCVBUF)
+	int busy_poll_us; //!< 0 to disable or microseconds of busy polling on socket receive (SO_BUSY_POLL)
+	int kernel_timestamps; //!< 0 to timestamp frame sets when reassembled, non-zero for kernel arrival timestamps (SIOCGSTAMPNS)
+	uint64_t network_cpus; //!< 0 for any CPU or CPU affinity mask of library network thread
+	uint64_t decoding_cpus; //!< 0 for any CPU or CPU affinity mask of library decoding threads
+	int realtime_policy; //!< NHVD_SCHED_OTHER, NHVD_SCHED_FIFO or NHVD_SCHED_RR of library network and decoding threads
+	int realtime_priority; //!< priority (1-99) with NHVD_SCHED_FIFO or NHVD_SCHED_RR
+	const char *multicast_group; //!< NULL for unicast or IPv4/IPv6 multicast group to receive from (ip has to be NULL)
+	const char *multicast_source; //!< NULL for any-source or sender IP for source-specific multicast (SSM)
+	const char *multicast_interface; //!< NULL for default or interface name to join group on, e.g. "eth0"
 };
 
 /**
@@ -77,13 +104,20 @@ struct nhvd_net_config
  */
 struct nhvd_hw_config
 {
-	const char *hardware; //!< hardware type for decoding, e.g. "vaapi"
+	const char *hardware; //!< hardware type for decoding, e.g. "vaapi" or NULL/empty string/"none" for software decoding
 	const char *codec; //!< codec name, e.g. "h264", "vp8"
 	const char *device; //!< NULL/empty string or device, e.g. "/dev/dri/renderD128"
-	const char *pixel_format; //!< NULL for default or format, e.g. "rgb0", "bgr0", "nv12", "yuv420p"
+	const char *pixel_format; //!< NULL for default or format, e.g. "rgb0", "bgr0", "nv12", "yuv420p" (ignored in software decoding)
 	int width; //!< 0 to not specify, needed by some codecs
 	int height; //!< 0 to not specify, needed by some codecs
 	int profile; //!< 0 to leave as FF_PROFILE_UNKNOWN or profile e.g. FF_PROFILE_HEVC_MAIN, ...
+	int threads; //!< software decoding only, 0 for share of software_threads or number of threads
+	int frame_threading; //!< software decoding only, 0 for slice threading (lowest latency), non-zero to allow frame threading (adds frames of latency)
+	const char *output_format; //!< NULL/empty string or format frames are converted to if decoded in different format, e.g. "bgr0", "rgb0", "bgra", "rgba"
+	int skip_loop_filter; //!< software decoding only, NHVD_SKIP_NONE, NHVD_SKIP_NONREF or NHVD_SKIP_ALL frames without loop (deblocking) filter
+	int skip_nonref; //!< 0 to decode all frames, non-zero to skip non-reference frames (software decoding, H.264/HEVC hardware decoding)
+	int low_delay; //!< software decoding only, non-zero to set low delay flag and disable frame_threading
+	int lowres; //!< software decoding only, 0 for full resolution or 1, 2, 3 for 1/2, 1/4, 1/8 resolution (if supported by codec, e.g. mpeg4, mjpeg)
 };
 
 /**
@@ -92,12 +126,198 @@ struct nhvd_hw_config
  *
  * Raw data returned along decoded data (nhvd_receive_all).
  *
- * @see nhvd_receive_all
+ * @see nhvd_receive_all, nhvd_frame_ref, nhvd_frame_unref
  */
 struct nhvd_frame
 {
 	uint8_t *data; //!< pointer to encoded data
 	int size; //!< size of encoded data
+	AVBufferRef *buf; //!< NULL or reference counted buffer backing data (padded with AV_INPUT_BUFFER_PADDING_SIZE)
+};
+
+/**
+ * @struct nhvd_queue_stats
+ * @brief Network receive thread queue statistics.
+ *
+ * Statistics are only collected when receive_queue_size in nhvd_net_config is set.
+ *
+ * @see nhvd_get_queue_stats, nhvd_net_config
+ */
+struct nhvd_queue_stats
+{
+	int size; //!< queue size (receive_queue_size)
+	int depth; //!< number of frame sets waiting for decoding
+	int max_depth; //!< highest observed depth, size means the pipeline was saturated
+	uint64_t received; //!< number of frame sets received by network thread
+	uint64_t dropped; //!< number of frame sets dropped because the queue was full
+	uint64_t skipped; //!< number of stale frame sets skipped (max_backlog)
+};
+
+/**
+  * @brief Frame set processing stages measured in latency statistics
+  * @see nhvd_channel_stats
+  */
+enum nhvd_stage_enum
+{
+	NHVD_STAGE_QUEUE=0, //!< from frame set reassembled (kernel arrival with kernel_timestamps) to sending data to decoder
+	NHVD_STAGE_DECODE=1, //!< from sending data to decoder to receiving decoded frame
+	NHVD_STAGE_DELIVERY=2, //!< from receiving decoded frame to handing it to the user
+	NHVD_STAGE_TOTAL=3, //!< from frame set reassembled (kernel arrival with kernel_timestamps) to handing it to the user
+	NHVD_STAGES=4, //!< number of stages
+};
+
+/**
+ * @struct nhvd_latency_stats
+ * @brief Latency statistics of processing stage.
+ *
+ * @see nhvd_channel_stats, nhvd_get_stats
+ */
+struct nhvd_latency_stats
+{
+	uint64_t count; //!< number of measurements
+	double min_ms; //!< minimum latency
+	double avg_ms; //!< average latency
+	double p99_ms; //!< 99th percentile latency (histogram bucket upper bound)
+	double max_ms; //!< maximum latency
+};
+
+/**
+ * @struct nhvd_channel_stats
+ * @brief Per channel statistics.
+ *
+ * Counters are cumulative since nhvd_init.
+ * Auxiliary channels have only NHVD_STAGE_TOTAL latency.
+ *
+ * @see nhvd_get_stats
+ */
+struct nhvd_channel_stats
+{
+	uint64_t received; //!< number of non-empty frames received
+	uint64_t decoded; //!< number of decoded frames returned to the user
+	uint64_t dropped; //!< number of frames dropped (skipped backlog, waiting for keyframe), full queue drops are in nhvd_queue_stats
+	uint64_t incomplete; //!< number of frames which were not decoded (e.g. incomplete, corrupted, decoder delay)
+	uint64_t paused; //!< number of frames discarded because channel was paused
+	uint64_t reconfigured; //!< number of decoder rebuilds after stream parameters change
+	double first_frame_ms; //!< time from nhvd_init to the first decoded frame of channel, 0 before
+	uint64_t reference_losses; //!< number of detected losses (H.264 frame_num gaps, frames decoded with errors)
+	uint64_t keyframe_requests; //!< number of keyframe requests sent to feedback_ip
+	uint64_t bytes; //!< number of encoded bytes received
+	double bytes_per_second; //!< encoded bitrate since previous nhvd_get_stats call
+	struct nhvd_latency_stats latency[NHVD_STAGES]; //!< per stage latency, indexed by nhvd_stage_enum
+};
+
+/**
+ * @struct nhvd_capture_stats
+ * @brief Capture (recording to disk) statistics.
+ *
+ * Frame sets are written by library I/O thread. When storage doesn't keep up
+ * the frame sets are dropped from capture, never blocking receiving and decoding.
+ *
+ * @see nhvd_get_stats, nhvd_net_config
+ */
+struct nhvd_capture_stats
+{
+	int size; //!< capture queue size (capture_queue_size)
+	int depth; //!< number of frame sets waiting for writing
+	int max_depth; //!< highest observed depth, size means storage didn't keep up
+	uint64_t recorded; //!< number of frame sets written
+	uint64_t dropped; //!< number of frame sets not captured (full capture queue or write error)
+	uint64_t bytes; //!< number of bytes written
+};
+
+/**
+ * @struct nhvd_stats
+ * @brief Library statistics.
+ *
+ * @see nhvd_get_stats
+ */
+struct nhvd_stats
+{
+	uint64_t timeouts; //!< number of receive timeouts
+	uint64_t flushes; //!< number of decoders flushes
+	struct nhvd_queue_stats queue; //!< zeroed without receive_queue_size
+	struct nhvd_capture_stats capture; //!< zeroed without capture_file
+	uint64_t pool_exhausted; //!< decoded frames not passed to callbacks because user held the whole frame pool
+	uint32_t jitter_us; //!< smoothed frame sets inter-arrival jitter, zeroed without jitter_buffer_ms
+	uint32_t jitter_delay_us; //!< current jitter buffer target delay, zeroed without jitter_buffer_ms
+	double init_ms; //!< time spent in nhvd_init
+	double first_frame_ms; //!< time from nhvd_init to the first decoded frame of any channel, 0 before
+	uint64_t socket_drops; //!< datagrams dropped by kernel because socket receive buffer was full (Linux 4.12+, NHVD_MLSP_SOCKET)
+	int socket_buffer_size; //!< socket receive buffer size granted by kernel (twice the requested, less if capped by net.core.rmem_max)
+};
+
+/**
+ * @struct nhvd_keyframe_request
+ * @brief Keyframe request datagram sent to the sender.
+ *
+ * Sent over UDP to feedback_ip and feedback_port of nhvd_net_config.
+ * The sender should encode the next frame of the channel as keyframe (IDR).
+ * Requests may be lost or repeated, multi-byte fields are in network byte order.
+ *
+ * @see nhvd_net_config, NHVD_KEYFRAME_REQUEST_MAGIC
+ */
+struct nhvd_keyframe_request
+{
+	char magic[4]; //!< NHVD_KEYFRAME_REQUEST_MAGIC without terminating zero
+	uint16_t channel; //!< video channel index
+	uint16_t sequence; //!< incremented with every request
+};
+
+//! Magic of nhvd_keyframe_request
+#define NHVD_KEYFRAME_REQUEST_MAGIC "NHKF"
+
+/**
+  * @brief Policy for skipping stale frame sets when max_backlog is exceeded
+  * @see nhvd_net_config
+  */
+enum nhvd_backlog_policy_enum
+{
+	NHVD_BACKLOG_KEYFRAME=0, //!< skip to the newest keyframe set, or the newest set and drop video until keyframe
+	NHVD_BACKLOG_DECODE=1, //!< decode stale frame sets without returning them
+};
+
+/**
+  * @brief Frames affected by skip_loop_filter
+  * @see nhvd_hw_config
+  */
+enum nhvd_skip_enum
+{
+	NHVD_SKIP_NONE=0, //!< don't skip
+	NHVD_SKIP_NONREF=1, //!< skip for non-reference frames
+	NHVD_SKIP_ALL=2, //!< skip for all frames
+};
+
+/**
+  * @brief Decoders handling on receive timeout
+  * @see nhvd_net_config
+  */
+enum nhvd_timeout_policy_enum
+{
+	NHVD_TIMEOUT_FLUSH=0, //!< flush decoders on every timeout (new streaming sequence)
+	NHVD_TIMEOUT_KEEP=1, //!< keep decoders state and resume the stream
+	NHVD_TIMEOUT_LAZY=2, //!< keep decoders state, flush only if the stream restarts with keyframe
+};
+
+/**
+  * @brief Decoders initialization
+  * @see nhvd_net_config
+  */
+enum nhvd_init_enum
+{
+	NHVD_INIT_SEQUENTIAL=0, //!< initialize decoders one after another in nhvd_init
+	NHVD_INIT_PARALLEL=1, //!< initialize decoders in parallel in nhvd_init
+	NHVD_INIT_LAZY=2, //!< initialize decoder on channel first packet with parameters from SPS/VPS
+};
+
+/**
+  * @brief Scheduling policy of library threads
+  * @see nhvd_net_config
+  */
+enum nhvd_sched_enum
+{
+	NHVD_SCHED_OTHER=0, //!< default time-sharing scheduling
+	NHVD_SCHED_FIFO=1, //!< real-time first-in first-out (SCHED_FIFO)
+	NHVD_SCHED_RR=2, //!< real-time round-robin (SCHED_RR)
 };
 
 /**
@@ -105,6 +325,7 @@ struct nhvd_frame
   */
 enum nhvd_retval_enum
 {
+	NHVD_WOULD_BLOCK=-3, //!< no frame set ready in non-blocking receive
 	NHVD_TIMEOUT=-2, //!< timeout on receive
 	NHVD_ERROR=-1, //!< error occured
 	NHVD_OK=0, //!< succesfull execution
@@ -116,6 +337,98 @@ enum nhvd_retval_enum
  * Initialize streaming and single or multiple (hw_size > 1) hardware decoders
  * and (aux_size > 1) auxiliary non-video raw data channels.
  *
+ * The number of channels hw_size + aux_size is limited by NHVD_MAX_CHANNELS (MLSP subframes limit).
+ *
+ * If receive_queue_size in net_config is set the network data is received
+ * by library owned thread and queued for decoding. This way receiving and decoding
+ * overlap in time. Threaded receiving requires non-zero timeout_ms.
+ *
+ * Channels with NULL, empty or "none" hardware in hw_config are decoded in software
+ * with libavcodec slice (or frame) threading. Software decoded frames are returned
+ * in system memory in decoder native pixel format (e.g. yuv420p).
+ *
+ * If max_backlog in net_config is set (requires receive_queue_size) and more frame sets
+ * are waiting in queue, the library skips to the freshest data to bound the latency:
+ * - NHVD_BACKLOG_KEYFRAME skips to the newest keyframes or drops video until keyframe
+ * - NHVD_BACKLOG_DECODE decodes stale frame sets but doesn't return them
+ *
+ * Keyframes are detected in H.264, HEVC and VP8 streams.
+ *
+ * If output_format in hw_config is set and decoded frames come in different pixel format
+ * (e.g. hardware can't output requested pixel_format, software decoding) the library converts them.
+ * NV12, YUV420P and P010 to RGB0, BGR0, RGBA and BGRA use SIMD (AVX2, SSE2, NEON) selected at runtime,
+ * other formats use libswscale. With parallel_decoding the conversion runs on decoding threads.
+ *
+ * On receive timeout decoders are flushed (NHVD_TIMEOUT_FLUSH). With short network
+ * stalls keeping the decoder state recovers faster (timeout_policy in net_config):
+ * - NHVD_TIMEOUT_KEEP resumes decoding as if nothing happened
+ * - NHVD_TIMEOUT_LAZY flushes decoder only if the data after timeout starts with keyframe
+ *
+ * Decoding may trade quality for speed with hw_config:
+ * - skip_loop_filter skips deblocking (software decoding)
+ * - skip_nonref skips non-reference frames (software decoding, H.264 and HEVC hardware decoding)
+ * - low_delay sets libavcodec low delay flag (software decoding)
+ * - threads sets number of threads (software decoding)
+ * - lowres decodes at reduced resolution (software decoding, codec dependent)
+ *
+ * Hardware decoders are configured by HVD which doesn't expose the decoder context.
+ * For them non-reference packets are dropped before decoding, other knobs are ignored.
+ *
+ * If parallel_decoding in net_config is set and hw_size > 1 each hardware decoder
+ * is driven by its own thread. The latency of decoding the set of frames is then
+ * close to the latency of the slowest channel rather than the sum of all channels.
+ *
+ * If jitter_buffer_ms in net_config is set (requires receive_queue_size) frame sets are held
+ * in queue and released at smoothed pace instead of the moment they arrive. The buffer depth
+ * follows measured inter-arrival jitter and never exceeds jitter_buffer_ms. Pacing applies to
+ * blocking receive (nhvd_receive, nhvd_receive_all, the first set of nhvd_receive_batch, callbacks),
+ * nhvd_receive_nonblock returns frame sets as they arrive.
+ *
+ * Decoders are initialized one after another (decoder_init in net_config):
+ * - NHVD_INIT_PARALLEL initializes them in parallel, device open and codec setup overlap
+ * - NHVD_INIT_LAZY defers decoder creation until the channel receives data.
+ *   H.264 and HEVC channels wait for SPS and take width, height and profile from it.
+ *   Decoder errors (e.g. device) are then reported by receive functions.
+ * See init_ms and first_frame_ms in nhvd_stats.
+ *
+ * H.264 and HEVC channels track SPS in received data. When stream parameters change
+ * (resolution, profile, bit depth, chroma format) only decoder of that channel is rebuilt,
+ * network and other channels keep working. See reconfigured in nhvd_channel_stats.
+ *
+ * If feedback_ip in net_config is set the library asks the sender for keyframe
+ * (nhvd_keyframe_request over UDP) instead of waiting for the next one after loss:
+ * - H.264 reference frames missing from frame_num sequence
+ * - frames decoded with errors (corrupted references)
+ * - channel waiting for keyframe (skipped backlog, resumed channel, lazy init without SPS)
+ * - flush on timeout when the stream doesn't restart with keyframe
+ *
+ * Requests are repeated every feedback_interval_ms until keyframe arrives.
+ * See reference_losses and keyframe_requests in nhvd_channel_stats.
+ *
+ * With NHVD_MLSP_SOCKET build option network socket is created by the library and used by MLSP
+ * (mlsp_init_server_socket, the library keeps ownership and closes it).
+ * Otherwise MLSP owns the socket and the options below fail in nhvd_init.
+ * The socket may be tuned for high bitrates in net_config (ignored in replay):
+ * - receive_buffer_size sets SO_RCVBUF (SO_RCVBUFFORCE with CAP_NET_ADMIN above net.core.rmem_max)
+ * - busy_poll_us sets SO_BUSY_POLL (requires CAP_NET_ADMIN)
+ * - kernel_timestamps makes latency statistics start at kernel arrival of frame set last datagram
+ * See socket_drops and socket_buffer_size in nhvd_stats.
+ *
+ * If multicast_group in net_config is set (NHVD_MLSP_SOCKET) the library joins IPv4 or IPv6 multicast group
+ * (source-specific with multicast_source) and receives MLSP frame sets sent to the group.
+ * The library socket is bound to the group so unicast datagrams to the port are not received.
+ * Many receivers share single stream, sender bandwidth doesn't grow with their number.
+ *
+ * Library threads may be pinned to CPUs (network_cpus, decoding_cpus) and run with
+ * real-time scheduling (realtime_policy, realtime_priority, requires CAP_SYS_NICE or RLIMIT_RTPRIO).
+ * The network thread exists with receive_queue_size. Decoding threads are parallel_decoding
+ * workers and the callbacks thread. Decoding on the caller thread is not affected.
+ *
+ * If capture_file in net_config is set every received frame set (all channels
+ * and arrival timestamp) is recorded by library I/O thread. Receiving and decoding
+ * never wait for storage, see nhvd_capture_stats. If replay_file is set frame sets are read
+ * from such capture instead of network. Replay ends with NHVD_ERROR at the end of file.
+ *
  * @param net_config network configuration
  * @param hw_config hardware decoders configuration of hw_size size
  * @param hw_size number of supplied hardware decoder configurations
@@ -161,7 +474,7 @@ void nhvd_close(struct nhvd *n);
  * For AVFrame you are mainly interested in its data and linesize arrays.
  *
  * If the function returns NHVD_TIMEOUT you may immidiately proceed with
- * next nhvd_receive. The hardware is flushed and network prepared for new
+ * next nhvd_receive. The hardware is flushed (see timeout_policy) and network prepared for new
  * streaming sequence.
  *
  *
@@ -207,10 +520,13 @@ int nhvd_receive(struct nhvd *n, AVFrame *frames[]);
  * The ownership of raws nhvd_frame set data remains with the library and
  * is valid only until next call to nhvd_recive so:
  * - consume it immidiately
- * - or copy if necessary
+ * - or reference the data with nhvd_frame_ref
+ *
+ * With receive_queue_size raws are backed by reference counted buffers
+ * and referencing them doesn't copy the data.
  *
  * If the function returns NHVD_TIMEOUT you may immidiately proceed with
- * next nhvd_receive. The hardware is flushed and network prepared for new
+ * next nhvd_receive. The hardware is flushed (see timeout_policy) and network prepared for new
  * streaming sequence.
  *
  * @param n pointer to internal library data
@@ -226,6 +542,441 @@ int nhvd_receive(struct nhvd *n, AVFrame *frames[]);
  */
 int nhvd_receive_all(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws);
 
+/**
+ * @brief Receive next set of frames without blocking
+ *
+ * Non-blocking variant of nhvd_receive_all for event loops.
+ * Requires receive_queue_size in nhvd_net_config.
+ *
+ * Returns NHVD_WOULD_BLOCK when no frame set is ready. Wait for
+ * file descriptor from nhvd_get_fd to become readable (poll, epoll, ...)
+ * and call the function again. The descriptor stays readable until
+ * the function returns NHVD_WOULD_BLOCK.
+ *
+ * The data ownership and lifetime is the same as in nhvd_receive_all.
+ *
+ * @param n pointer to internal library data
+ * @param frames array of AVFrame* of size matching nhvd_init hw_size
+ * @param raws NULL or array of nhvd_frame of size matching nhvd_init hw_size + aux_size
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_WOULD_BLOCK if there is no frame set ready
+ * - NHVD_ERROR on error
+ * - NHVD_TIMEOUT on receive timeout
+ *
+ * @see nhvd_get_fd, nhvd_receive_all
+ */
+int nhvd_receive_nonblock(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws);
+
+/**
+ * @brief Get file descriptor signalling frame sets ready for nhvd_receive_nonblock
+ *
+ * The descriptor becomes readable when frame set (or timeout or error) is ready.
+ * Use it only for waiting (poll, select, epoll), don't read or close it.
+ * Requires receive_queue_size in nhvd_net_config.
+ *
+ * @param n pointer to internal library data
+ * @return
+ * - file descriptor on success
+ * - NHVD_ERROR on error
+ *
+ * @see nhvd_receive_nonblock
+ */
+int nhvd_get_fd(struct nhvd *n);
+
+/**
+ * @brief Receive all available sets of frames with both decoded and encoded data
+ *
+ * Function blocks until the first set of frames is received and decoded or timeout occurs.
+ * Then it decodes and returns all the other frame sets that are already received,
+ * up to max_sets, without blocking. This reduces per call overhead at high
+ * framerates and with many channels. Datagrams are still received by MLSP
+ * one at a time, the batch works on frame sets already in receive queue.
+ *
+ * Returned frame sets don't occupy receive queue, the library keeps
+ * own references to their data and releases queue entries immediately.
+ *
+ * Without receive_queue_size at most one frame set is returned.
+ *
+ * Frames and raws are stored set after set, e.g. frame of channel c
+ * in set s is frames[s * hw_size + c].
+ *
+ * The ownership of returned data remains with the library and is valid
+ * until next call to nhvd_receive_batch (or nhvd_receive, nhvd_receive_all),
+ * see nhvd_receive_all for details.
+ *
+ * @param n pointer to internal library data
+ * @param frames array of AVFrame* of size matching max_sets * hw_size
+ * @param raws NULL or array of nhvd_frame of size max_sets * (hw_size + aux_size)
+ * @param max_sets maximum number of returned frame sets
+ * @return
+ * - number of returned frame sets on success
+ * - NHVD_ERROR on error
+ * - NHVD_TIMEOUT on receive timeout
+ *
+ * @see nhvd_receive_all, nhvd_init
+ */
+int nhvd_receive_batch(struct nhvd *n, AVFrame *frames[], struct nhvd_frame *raws, int max_sets);
+
+/**
+ * @brief Reference raw frame data
+ *
+ * Keep raw data returned by nhvd_receive_all beyond next call.
+ * Reference counted data (with receive_queue_size) is not copied.
+ * Otherwise the data is copied to new reference counted buffer.
+ *
+ * Release the data with nhvd_frame_unref.
+ *
+ * @param dst frame to be filled with new reference
+ * @param src frame returned by nhvd_receive_all
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error
+ *
+ * @see nhvd_frame_unref, nhvd_receive_all
+ */
+int nhvd_frame_ref(struct nhvd_frame *dst, const struct nhvd_frame *src);
+
+/**
+ * @brief Release raw frame data reference
+ *
+ * @param frame frame referenced with nhvd_frame_ref
+ *
+ * @see nhvd_frame_ref
+ */
+void nhvd_frame_unref(struct nhvd_frame *frame);
+
+/**
+ * @brief Callback with decoded frame set (push mode)
+ *
+ * Called on library delivery thread. Each non-NULL frame comes from library frame pool,
+ * references decoder data (no copy) and belongs to the user until nhvd_frame_release.
+ * Frame is NULL if it was not decoded or the user holds the whole frame pool.
+ * The raws are valid only until the callback returns (reference them with nhvd_frame_ref).
+ *
+ * @param frames array of AVFrame* of size matching nhvd_init hw_size, NULL unless status is NHVD_OK
+ * @param raws array of nhvd_frame of size hw_size + aux_size, NULL unless status is NHVD_OK
+ * @param status NHVD_OK, NHVD_TIMEOUT or NHVD_ERROR (no more callbacks)
+ * @param user user data from nhvd_callback_config
+ * @see nhvd_start_callbacks, nhvd_frame_release
+ */
+typedef void (*nhvd_frame_set_callback)(AVFrame *frames[], struct nhvd_frame *raws, int status, void *user);
+
+/**
+ * @brief Callback with decoded frame of single channel (push mode)
+ *
+ * Called on library delivery thread for every decoded frame.
+ * The frame comes from library frame pool and belongs to the user until nhvd_frame_release.
+ * The raw is valid only until the callback returns.
+ *
+ * On error (e.g. network receive failure) the callback is called once for every channel
+ * with NULL frame and raw. No more callbacks follow.
+ *
+ * @param channel video channel index
+ * @param frame decoded frame or NULL on error
+ * @param raw encoded data of the frame or NULL on error
+ * @param user user data from nhvd_callback_config
+ * @see nhvd_start_callbacks, nhvd_frame_release
+ */
+typedef void (*nhvd_channel_callback)(int channel, AVFrame *frame, const struct nhvd_frame *raw, void *user);
+
+/**
+ * @struct nhvd_callback_config
+ * @brief Push mode configuration, set exactly one of callbacks.
+ *
+ * @see nhvd_start_callbacks
+ */
+struct nhvd_callback_config
+{
+	nhvd_frame_set_callback frame_set; //!< NULL or called with every frame set
+	nhvd_channel_callback channel; //!< NULL or called with every decoded frame
+	void *user; //!< passed to callback
+	int frame_pool_size; //!< 0 for default (4 per video channel) or number of frames the user may hold at once
+};
+
+/**
+ * @brief Start delivering frames to callbacks (push mode)
+ *
+ * Library thread receives and decodes frame sets and passes them to the callback.
+ * Don't call receive functions after starting callbacks. Requires positive timeout_ms.
+ *
+ * Frames are taken from preallocated, bounded frame pool. The frames reference
+ * decoder data so there is no allocation or copy per frame. Return them with
+ * nhvd_frame_release as soon as possible, decoders may run out of surfaces otherwise.
+ * When the user holds the whole pool the new frames are not delivered (see pool_exhausted
+ * in nhvd_stats).
+ *
+ * Callbacks stop in nhvd_close. Release all frames before nhvd_close.
+ *
+ * @param n pointer to internal library data
+ * @param config callback configuration
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error
+ *
+ * @see nhvd_callback_config, nhvd_frame_release
+ */
+int nhvd_start_callbacks(struct nhvd *n, const struct nhvd_callback_config *config);
+
+/**
+ * @brief Return frame passed to callback to the frame pool
+ *
+ * May be called from any thread.
+ *
+ * @param n pointer to internal library data
+ * @param frame frame passed to nhvd_frame_set_callback or nhvd_channel_callback
+ * @see nhvd_start_callbacks
+ */
+void nhvd_frame_release(struct nhvd *n, AVFrame *frame);
+
+/**
+ * @brief Retrieve library statistics
+ *
+ * Statistics are always collected, the overhead is a few timestamps per frame set.
+ * Call from the same thread as nhvd_receive (or from callback in push mode).
+ *
+ * @param n pointer to internal library data
+ * @param stats pointer to statistics filled by the library
+ * @param channels NULL or array of nhvd_channel_stats of size hw_size + aux_size
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error
+ *
+ * @see nhvd_stats, nhvd_channel_stats
+ */
+int nhvd_get_stats(struct nhvd *n, struct nhvd_stats *stats, struct nhvd_channel_stats *channels);
+
+/**
+ * @brief Pause decoding of video channel
+ *
+ * Packets of paused channel are discarded without decoding and its frame is NULL.
+ * Raw data is still returned by nhvd_receive_all. Decoder is flushed to release
+ * its resources. Use to save decoder and CPU time when nothing consumes the channel.
+ *
+ * May be called from any thread, takes effect with the next frame set.
+ *
+ * @param n pointer to internal library data
+ * @param channel index of hardware decoder configuration in nhvd_init
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error (e.g. not a video channel)
+ *
+ * @see nhvd_resume_channel
+ */
+int nhvd_pause_channel(struct nhvd *n, int channel);
+
+/**
+ * @brief Resume decoding of paused video channel
+ *
+ * Decoding resumes with the next keyframe (for codecs with keyframe detection).
+ *
+ * May be called from any thread, takes effect with the next frame set.
+ *
+ * @param n pointer to internal library data
+ * @param channel index of hardware decoder configuration in nhvd_init
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error (e.g. not a video channel)
+ *
+ * @see nhvd_pause_channel
+ */
+int nhvd_resume_channel(struct nhvd *n, int channel);
+
+/**
+ * @brief Retrieve network receive thread queue statistics
+ *
+ * Use this function to check if decoding keeps up with the network.
+ * Frame sets are dropped when the queue is full.
+ * Call from the same thread as nhvd_receive.
+ *
+ * @param n pointer to internal library data
+ * @param stats pointer to statistics filled by the library
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR if network receive thread is not used
+ *
+ * @see nhvd_net_config, nhvd_queue_stats
+ */
+int nhvd_get_queue_stats(struct nhvd *n, struct nhvd_queue_stats *stats);
+
+/**
+ * @struct nhvd_server
+ * @brief Internal multi-stream server data passed around by the user.
+ * @see nhvd_server_init, nhvd_server_close
+ */
+struct nhvd_server;
+
+/**
+ * @brief Callback with frame set decoded by multi-stream server
+ *
+ * Called on server worker thread. The frames and raws are valid only until
+ * the callback returns (see nhvd_receive_all), reference them to keep longer.
+ * Callbacks of the same stream are never concurrent, different streams are.
+ *
+ * @param stream index of stream in nhvd_server_init
+ * @param frames array of AVFrame* of stream hw_size, NULL unless status is NHVD_OK
+ * @param raws array of nhvd_frame of stream hw_size + aux_size, NULL unless status is NHVD_OK
+ * @param status NHVD_OK, NHVD_TIMEOUT or NHVD_ERROR (stream is not served anymore)
+ * @param user user data from nhvd_server_config
+ */
+typedef void (*nhvd_server_callback)(int stream, AVFrame *frames[], struct nhvd_frame *raws, int status, void *user);
+
+/**
+ * @struct nhvd_stream_config
+ * @brief Configuration of single stream served by multi-stream server.
+ *
+ * @see nhvd_server_init, nhvd_init
+ */
+struct nhvd_stream_config
+{
+	struct nhvd_net_config net_config; //!< network configuration, receive_queue_size and software_threads default to small values
+	const struct nhvd_hw_config *hw_config; //!< hardware decoders configuration of hw_size size
+	int hw_size; //!< number of supplied hardware decoder configurations
+	int aux_size; //!< number of auxiliary non-video raw data channels
+	int priority; //!< streams with higher priority are decoded first
+};
+
+/**
+ * @struct nhvd_server_config
+ * @brief Multi-stream server configuration.
+ *
+ * @see nhvd_server_init
+ */
+struct nhvd_server_config
+{
+	int workers; //!< 0 for number of cores or number of decoding threads shared by all streams
+	nhvd_server_callback callback; //!< called with every decoded frame set
+	void *user; //!< passed to callback
+};
+
+/**
+ * @brief Initialize multi-stream server
+ *
+ * Serve many streams (e.g. on different ports) with shared pool of decoding threads
+ * instead of thread per stream.
+ *
+ * Each stream is nhvd instance with network receive thread. Whichever worker is free
+ * takes the next stream that has data ready, decodes single frame set and calls the callback.
+ * Streams with higher priority go first, streams with equal priority take turns.
+ *
+ * Software decoded streams default to single thread each (software_threads)
+ * so that the number of busy threads stays close to the number of workers.
+ *
+ * @param config server configuration
+ * @param streams streams configuration of streams_size size
+ * @param streams_size number of streams
+ * @return
+ * - pointer to internal server data
+ * - NULL on error, errors printed to stderr
+ *
+ * @see nhvd_server_close, nhvd_stream_config, nhvd_server_config
+ */
+struct nhvd_server *nhvd_server_init(const struct nhvd_server_config *config,
+	const struct nhvd_stream_config *streams, int streams_size);
+
+/**
+ * @brief Stop server and free its resources
+ *
+ * Waits for callbacks in progress to finish.
+ * Must not be called from server callback (it would wait for itself),
+ * in that case nothing is closed and NHVD_ERROR is returned.
+ *
+ * @param s pointer to internal server data
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR if called from server callback
+ * @see nhvd_server_init
+ */
+int nhvd_server_close(struct nhvd_server *s);
+
+/**
+ * @brief Change stream priority
+ *
+ * May be called from any thread, including callbacks.
+ *
+ * @param s pointer to internal server data
+ * @param stream index of stream in nhvd_server_init
+ * @param priority streams with higher priority are decoded first
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error
+ */
+int nhvd_server_set_priority(struct nhvd_server *s, int stream, int priority);
+
+/**
+ * @struct nhvd_depth_config
+ * @brief Depth unprojection configuration.
+ *
+ * Pinhole camera intrinsics of the depth channel and depth encoding.
+ *
+ * @see nhvd_unproject_depth
+ */
+struct nhvd_depth_config
+{
+	float ppx; //!< principal point x in pixels
+	float ppy; //!< principal point y in pixels
+	float fx; //!< focal length x in pixels
+	float fy; //!< focal length y in pixels
+	float depth_unit; //!< multiplier from 16 bit depth value to meters (or other unit)
+	float min_margin; //!< points with depth not greater than this are invalid
+	float max_margin; //!< 0 for no limit or points with depth not less than this are invalid
+};
+
+/**
+ * @struct nhvd_point_cloud
+ * @brief Point cloud unprojected from depth.
+ *
+ * Zero initialize and pass to every nhvd_unproject_depth call.
+ * Memory is reused between calls and grows only with resolution.
+ * Free with nhvd_point_cloud_free.
+ *
+ * @see nhvd_unproject_depth, nhvd_point_cloud_free
+ */
+struct nhvd_point_cloud
+{
+	float (*data)[3]; //!< XYZ point per depth pixel in row order, zero for invalid depth
+	uint32_t *colors; //!< texture pixel (4 bytes in texture order) per point, NULL if the last call had no texture
+	int size; //!< allocated number of points
+	int used; //!< number of points in last call (depth width * height)
+};
+
+/**
+ * @brief Unproject depth frame to point cloud
+ *
+ * Depth is 16 bit value in luma of P010LE (e.g. HEVC Main10 depth stream) or GRAY16LE frame.
+ * Each pixel (u, v) with depth d becomes point:
+ * - z = d * depth_unit
+ * - x = (u - ppx) * z / fx
+ * - y = (v - ppy) * z / fy
+ *
+ * Points with depth outside of margins are zero.
+ * Optionally colors are attached from texture channel of the same resolution
+ * in 4 byte format (RGB0, BGR0, RGBA, BGRA), e.g. through output_format of nhvd_hw_config.
+ *
+ * Uses SIMD (SSE2/NEON) with plain C fallback.
+ *
+ * @param config depth camera configuration
+ * @param depth decoded depth frame
+ * @param texture NULL or decoded texture frame
+ * @param pc point cloud filled by the library
+ * @return
+ * - NHVD_OK on success
+ * - NHVD_ERROR on error (e.g. unsupported pixel format), errors printed to stderr
+ *
+ * @see nhvd_depth_config, nhvd_point_cloud, nhvd_point_cloud_free
+ */
+int nhvd_unproject_depth(const struct nhvd_depth_config *config, const AVFrame *depth,
+	const AVFrame *texture, struct nhvd_point_cloud *pc);
+
+/**
+ * @brief Free point cloud memory
+ *
+ * The point cloud may be reused afterwards.
+ *
+ * @param pc point cloud filled by nhvd_unproject_depth
+ * @see nhvd_unproject_depth
+ */
+void nhvd_point_cloud_free(struct nhvd_point_cloud *pc);
 
 /** @}*/
 
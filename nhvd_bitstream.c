@@ -0,0 +1,372 @@
+/*
+ * NHVD Network Hardware Video Decoder bitstream parsing implementation
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "nhvd_bitstream.h"
+
+#include <libavcodec/avcodec.h>
+
+enum { NHVD_SPS_MAX_SIZE = 1024 }; //unescaped bytes, more than needed for parsed fields
+enum { NHVD_SPS_MAX_DIMENSION = 16384 };
+
+enum { NHVD_H264_NAL_SPS = 7, NHVD_HEVC_NAL_SPS = 33 };
+
+//exp-Golomb reader of unescaped RBSP, reading past the end sets error
+struct nhvd_bits
+{
+	const uint8_t *data;
+	int size; //bits
+	int pos; //bits
+	int error;
+};
+
+static int nhvd_parse_h264_sps(struct nhvd_bits *b, struct nhvd_sps *sps);
+static int nhvd_parse_hevc_sps(struct nhvd_bits *b, struct nhvd_sps *sps);
+static int nhvd_parse_nal(const uint8_t *nal, int size, int header, uint8_t *rbsp, int rbsp_size, struct nhvd_bits *b);
+static int nhvd_unescape(const uint8_t *nal, int size, uint8_t *rbsp, int rbsp_size);
+static uint32_t nhvd_bits_read(struct nhvd_bits *b, int n);
+static void nhvd_bits_skip(struct nhvd_bits *b, int n);
+static uint32_t nhvd_bits_ue(struct nhvd_bits *b);
+static int32_t nhvd_bits_se(struct nhvd_bits *b);
+
+int nhvd_parse_sps(int hevc, const uint8_t *data, int size, struct nhvd_sps *sps)
+{
+	uint8_t rbsp[NHVD_SPS_MAX_SIZE];
+
+	for(int i=0;i + 3 < size;++i)
+	{
+		if(data[i] || data[i+1] || data[i+2] != 1)
+			continue;
+
+		const uint8_t *nal = data + i + 3;
+		const int type = hevc ? (nal[0] >> 1) & 0x3F : nal[0] & 0x1F;
+		const int header = hevc ? 2 : 1;
+
+		//parameter sets precede coded picture data
+		if( (hevc && type <= 31) || (!hevc && type >= 1 && type <= 5) )
+			return 0;
+
+		if(type != (hevc ? NHVD_HEVC_NAL_SPS : NHVD_H264_NAL_SPS) || size - (i + 3) <= header)
+		{
+			i += 2;
+			continue;
+		}
+
+		struct nhvd_bits b;
+
+		nhvd_parse_nal(nal, size - (i + 3), header, rbsp, sizeof(rbsp), &b);
+
+		if( (hevc ? nhvd_parse_hevc_sps(&b, sps) : nhvd_parse_h264_sps(&b, sps)) != 0 || b.error)
+			return -1;
+
+		if(sps->width <= 0 || sps->height <= 0 || sps->width > NHVD_SPS_MAX_DIMENSION || sps->height > NHVD_SPS_MAX_DIMENSION)
+			return -1;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int nhvd_parse_frame_num(const uint8_t *data, int size, const struct nhvd_sps *sps, int *frame_num)
+{
+	uint8_t rbsp[16]; //slice header fields up to frame_num
+
+	for(int i=0;i + 4 < size;++i)
+	{
+		if(data[i] || data[i+1] || data[i+2] != 1)
+			continue;
+
+		const uint8_t *nal = data + i + 3;
+		const int type = nal[0] & 0x1F;
+
+		if(type < 1 || type > 5) //coded slice
+		{
+			i += 2;
+			continue;
+		}
+
+		struct nhvd_bits b;
+
+		nhvd_parse_nal(nal, size - (i + 3), 1, rbsp, sizeof(rbsp), &b);
+
+		nhvd_bits_ue(&b); //first_mb_in_slice
+		nhvd_bits_ue(&b); //slice_type
+		nhvd_bits_ue(&b); //pic_parameter_set_id
+
+		if(sps->separate_colour_plane)
+			nhvd_bits_skip(&b, 2); //colour_plane_id
+
+		*frame_num = nhvd_bits_read(&b, sps->log2_max_frame_num);
+
+		return b.error ? -1 : 1;
+	}
+
+	return 0;
+}
+
+//reader of NAL unit RBSP after header bytes, RBSP truncated to rbsp_size
+static int nhvd_parse_nal(const uint8_t *nal, int size, int header, uint8_t *rbsp, int rbsp_size, struct nhvd_bits *b)
+{
+	const struct nhvd_bits bits = {rbsp, 8 * nhvd_unescape(nal + header, size - header, rbsp, rbsp_size), 0, 0};
+
+	*b = bits;
+
+	return b->size;
+}
+
+//ITU-T H.264 7.3.2.1.1
+static int nhvd_parse_h264_sps(struct nhvd_bits *b, struct nhvd_sps *sps)
+{
+	const int profile_idc = nhvd_bits_read(b, 8);
+	const int constraints = nhvd_bits_read(b, 8);
+	int separate_planes = 0, frame_mbs_only, crop_x = 1, crop_y = 1;
+
+	nhvd_bits_skip(b, 8); //level_idc
+	nhvd_bits_ue(b); //seq_parameter_set_id
+
+	sps->chroma_format = 1;
+	sps->bit_depth = 8;
+	sps->separate_colour_plane = 0;
+
+	if(profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 ||
+		profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118 ||
+		profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134 || profile_idc == 135)
+	{
+		if( (sps->chroma_format = nhvd_bits_ue(b)) > 3)
+			return -1;
+		if(sps->chroma_format == 3)
+			sps->separate_colour_plane = separate_planes = nhvd_bits_read(b, 1);
+
+		sps->bit_depth = nhvd_bits_ue(b) + 8;
+		nhvd_bits_ue(b); //bit_depth_chroma_minus8
+		nhvd_bits_skip(b, 1); //qpprime_y_zero_transform_bypass_flag
+
+		if(nhvd_bits_read(b, 1)) //seq_scaling_matrix_present_flag
+			for(int i=0;i < (sps->chroma_format != 3 ? 8 : 12) && !b->error;++i)
+			{
+				if(!nhvd_bits_read(b, 1)) //seq_scaling_list_present_flag
+					continue;
+
+				//delta coded list, zero next_scale ends it
+				for(int j=0, last = 8, next = 8;j < (i < 6 ? 16 : 64) && next && !b->error;++j)
+				{
+					next = (last + nhvd_bits_se(b) + 256) % 256;
+					last = next ? next : last;
+				}
+			}
+	}
+
+	if( (sps->log2_max_frame_num = nhvd_bits_ue(b) + 4) > 16)
+		return -1;
+
+	switch(nhvd_bits_ue(b)) //pic_order_cnt_type
+	{
+		case 0:
+			nhvd_bits_ue(b); //log2_max_pic_order_cnt_lsb_minus4
+			break;
+		case 1:
+		{
+			nhvd_bits_skip(b, 1); //delta_pic_order_always_zero_flag
+			nhvd_bits_se(b); //offset_for_non_ref_pic
+			nhvd_bits_se(b); //offset_for_top_to_bottom_field
+
+			const uint32_t cycle = nhvd_bits_ue(b);
+
+			if(cycle > 255)
+				return -1;
+
+			for(uint32_t i=0;i<cycle;++i)
+				nhvd_bits_se(b); //offset_for_ref_frame
+			break;
+		}
+		case 2:
+			break;
+		default:
+			return -1;
+	}
+
+	nhvd_bits_ue(b); //max_num_ref_frames
+	nhvd_bits_skip(b, 1); //gaps_in_frame_num_value_allowed_flag
+
+	const uint32_t width_mbs = nhvd_bits_ue(b) + 1;
+	const uint32_t height_map_units = nhvd_bits_ue(b) + 1;
+
+	if( !(frame_mbs_only = nhvd_bits_read(b, 1)) )
+		nhvd_bits_skip(b, 1); //mb_adaptive_frame_field_flag
+
+	nhvd_bits_skip(b, 1); //direct_8x8_inference_flag
+
+	if(width_mbs > NHVD_SPS_MAX_DIMENSION / 16 || height_map_units > NHVD_SPS_MAX_DIMENSION / 16)
+		return -1;
+
+	sps->width = width_mbs * 16;
+	sps->height = (2 - frame_mbs_only) * height_map_units * 16;
+
+	if(sps->chroma_format && !separate_planes)
+	{
+		crop_x = sps->chroma_format == 3 ? 1 : 2;
+		crop_y = sps->chroma_format == 1 ? 2 : 1;
+	}
+
+	crop_y *= 2 - frame_mbs_only;
+
+	if(nhvd_bits_read(b, 1)) //frame_cropping_flag
+	{
+		const uint32_t left = nhvd_bits_ue(b), right = nhvd_bits_ue(b);
+		const uint32_t top = nhvd_bits_ue(b), bottom = nhvd_bits_ue(b);
+
+		sps->width -= crop_x * (left + right);
+		sps->height -= crop_y * (top + bottom);
+	}
+
+	sps->profile = profile_idc;
+
+	if(profile_idc == FF_PROFILE_H264_BASELINE && (constraints & 0x40))
+		sps->profile |= FF_PROFILE_H264_CONSTRAINED;
+
+	return 0;
+}
+
+//ITU-T H.265 7.3.2.2.1
+static int nhvd_parse_hevc_sps(struct nhvd_bits *b, struct nhvd_sps *sps)
+{
+	int max_sub_layers_minus1, profile_present[8], level_present[8];
+
+	nhvd_bits_skip(b, 4); //sps_video_parameter_set_id
+	max_sub_layers_minus1 = nhvd_bits_read(b, 3);
+	nhvd_bits_skip(b, 1); //sps_temporal_id_nesting_flag
+
+	//profile_tier_level
+	nhvd_bits_skip(b, 3); //general_profile_space, general_tier_flag
+	sps->profile = nhvd_bits_read(b, 5);
+	nhvd_bits_skip(b, 32 + 4 + 43 + 1 + 8); //compatibility and constraint flags, general_level_idc
+
+	for(int i=0;i<max_sub_layers_minus1;++i)
+	{
+		profile_present[i] = nhvd_bits_read(b, 1);
+		level_present[i] = nhvd_bits_read(b, 1);
+	}
+
+	if(max_sub_layers_minus1 > 0)
+		nhvd_bits_skip(b, 2 * (8 - max_sub_layers_minus1)); //reserved_zero_2bits
+
+	for(int i=0;i<max_sub_layers_minus1;++i)
+		nhvd_bits_skip(b, (profile_present[i] ? 88 : 0) + (level_present[i] ? 8 : 0));
+
+	nhvd_bits_ue(b); //sps_seq_parameter_set_id
+
+	if( (sps->chroma_format = nhvd_bits_ue(b)) > 3)
+		return -1;
+
+	if(sps->chroma_format == 3)
+		nhvd_bits_skip(b, 1); //separate_colour_plane_flag
+
+	sps->log2_max_frame_num = 0;
+	sps->separate_colour_plane = 0;
+
+	const uint32_t width = nhvd_bits_ue(b);
+	const uint32_t height = nhvd_bits_ue(b);
+
+	if(width > NHVD_SPS_MAX_DIMENSION || height > NHVD_SPS_MAX_DIMENSION)
+		return -1;
+
+	sps->width = width;
+	sps->height = height;
+
+	if(nhvd_bits_read(b, 1)) //conformance_window_flag
+	{
+		const int crop_x = sps->chroma_format == 1 || sps->chroma_format == 2 ? 2 : 1;
+		const int crop_y = sps->chroma_format == 1 ? 2 : 1;
+		const uint32_t left = nhvd_bits_ue(b), right = nhvd_bits_ue(b);
+		const uint32_t top = nhvd_bits_ue(b), bottom = nhvd_bits_ue(b);
+
+		sps->width -= crop_x * (left + right);
+		sps->height -= crop_y * (top + bottom);
+	}
+
+	sps->bit_depth = nhvd_bits_ue(b) + 8;
+
+	return 0;
+}
+
+//remove emulation prevention bytes (00 00 03), returns RBSP size
+static int nhvd_unescape(const uint8_t *nal, int size, uint8_t *rbsp, int rbsp_size)
+{
+	int out = 0, zeros = 0;
+
+	for(int i=0;i<size && out<rbsp_size;++i)
+	{
+		if(zeros >= 2 && nal[i] == 3)
+		{
+			zeros = 0;
+			continue;
+		}
+
+		//the next start code ends NAL unit
+		if(zeros >= 2 && nal[i] <= 1)
+			break;
+
+		zeros = nal[i] ? 0 : zeros + 1;
+		rbsp[out++] = nal[i];
+	}
+
+	return out;
+}
+
+static uint32_t nhvd_bits_read(struct nhvd_bits *b, int n)
+{
+	uint32_t value = 0;
+
+	if(b->pos + n > b->size)
+	{
+		b->error = 1;
+		b->pos = b->size;
+		return 0;
+	}
+
+	for(int i=0;i<n;++i, ++b->pos)
+		value = (value << 1) | ((b->data[b->pos >> 3] >> (7 - (b->pos & 7))) & 1);
+
+	return value;
+}
+
+static void nhvd_bits_skip(struct nhvd_bits *b, int n)
+{
+	if(b->pos + n > b->size)
+	{
+		b->error = 1;
+		b->pos = b->size;
+		return;
+	}
+
+	b->pos += n;
+}
+
+static uint32_t nhvd_bits_ue(struct nhvd_bits *b)
+{
+	int zeros = 0;
+
+	while(!nhvd_bits_read(b, 1) && !b->error)
+		if(++zeros > 31)
+		{
+			b->error = 1;
+			return 0;
+		}
+
+	return (((uint32_t)1 << zeros) - 1) + nhvd_bits_read(b, zeros);
+}
+
+static int32_t nhvd_bits_se(struct nhvd_bits *b)
+{
+	const uint32_t value = nhvd_bits_ue(b);
+
+	return value & 1 ? (int32_t)((value + 1) / 2) : -(int32_t)(value / 2);
+}
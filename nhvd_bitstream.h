@@ -0,0 +1,39 @@
+/*
+ * NHVD Network Hardware Video Decoder bitstream parsing internal header
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef NHVD_BITSTREAM_H
+#define NHVD_BITSTREAM_H
+
+//internal, not part of the public interface
+
+#include <stdint.h>
+
+//codec parameters from sequence parameter set
+struct nhvd_sps
+{
+	int width; //after cropping
+	int height; //after cropping
+	int profile; //FF_PROFILE_* value
+	int bit_depth; //luma
+	int chroma_format; //0 monochrome, 1 4:2:0, 2 4:2:2, 3 4:4:4
+	int log2_max_frame_num; //H.264 only
+	int separate_colour_plane; //H.264 only
+};
+
+//the first H.264 or HEVC (hevc non-zero) SPS before the first VCL NAL unit of Annex B data
+//1 if found, 0 if there is no SPS, -1 if SPS is malformed
+int nhvd_parse_sps(int hevc, const uint8_t *data, int size, struct nhvd_sps *sps);
+
+//frame_num of the first H.264 slice of Annex B data with parameters from its SPS
+//1 if found, 0 if there is no slice, -1 if slice header is malformed
+int nhvd_parse_frame_num(const uint8_t *data, int size, const struct nhvd_sps *sps, int *frame_num);
+
+#endif
@@ -0,0 +1,496 @@
+/*
+ * NHVD Network Hardware Video Decoder color conversion implementation
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "nhvd_convert.h"
+
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NHVD_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum { NHVD_CONVERT_ALIGN = 64 }; //output linesize alignment
+
+//YUV to RGB in Q6 fixed point, out = (y_coef * (Y - y_offset) + coef * (C - 128) + 32) >> 6
+//the same integer results in every kernel, checked by benchmarks/nhvd_convert_bench.c
+//sums may exceed int16 (e.g. blue up to 35102 for BT.709), SIMD kernels rely on saturating
+//adds for them, the saturated values are clamped to 255 as in C
+struct nhvd_yuv_coeffs
+{
+	int16_t y_offset;
+	int16_t y;
+	int16_t rv;
+	int16_t gu;
+	int16_t gv;
+	int16_t bu;
+};
+
+static const struct nhvd_yuv_coeffs NHVD_BT601_LIMITED = {16, 75, 102, 25, 52, 129};
+static const struct nhvd_yuv_coeffs NHVD_BT601_FULL = {0, 64, 90, 22, 46, 113};
+static const struct nhvd_yuv_coeffs NHVD_BT709_LIMITED = {16, 75, 115, 14, 34, 135};
+static const struct nhvd_yuv_coeffs NHVD_BT709_FULL = {0, 64, 101, 12, 30, 119};
+
+//converts pixels from x to width of 8 bit planar row with half width chroma to 4 byte pixels
+typedef void (*nhvd_yuv_row_fn)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr);
+
+struct nhvd_converter
+{
+	enum AVPixelFormat format;
+	int bgr; //B first in output pixel
+	nhvd_yuv_row_fn row; //NULL if output is not handled by kernels
+
+	AVFrame *frame;
+	AVBufferPool *pool;
+	int pool_size;
+
+	uint8_t *y, *u, *v; //rows deinterleaved or reduced to 8 bits
+	int rows_width;
+
+	struct SwsContext *sws;
+};
+
+static nhvd_yuv_row_fn nhvd_yuv_row_select(void);
+static void nhvd_yuv_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr);
+static int nhvd_convert_kernel(struct nhvd_converter *c, const AVFrame *in, AVFrame *out);
+static int nhvd_convert_sws(struct nhvd_converter *c, const AVFrame *in, AVFrame *out);
+static int nhvd_converter_buffer(struct nhvd_converter *c, const AVFrame *in);
+static int nhvd_converter_rows(struct nhvd_converter *c, int width);
+static struct nhvd_converter *nhvd_converter_close_and_return_null(struct nhvd_converter *c, const char *msg);
+
+struct nhvd_converter *nhvd_converter_init(const char *output_format)
+{
+	struct nhvd_converter *c, zero_converter = {0};
+
+	if( (c = (struct nhvd_converter*)malloc(sizeof(struct nhvd_converter))) == NULL)
+		return nhvd_converter_close_and_return_null(NULL, "not enough memory for converter");
+
+	*c = zero_converter;
+
+	if( (c->format = av_get_pix_fmt(output_format)) == AV_PIX_FMT_NONE)
+		return nhvd_converter_close_and_return_null(c, "unknown output pixel format");
+
+	if( (c->frame = av_frame_alloc()) == NULL)
+		return nhvd_converter_close_and_return_null(c, "not enough memory for converter frame");
+
+	if(c->format == AV_PIX_FMT_RGB0 || c->format == AV_PIX_FMT_RGBA ||
+		c->format == AV_PIX_FMT_BGR0 || c->format == AV_PIX_FMT_BGRA)
+		c->row = nhvd_yuv_row_select();
+
+	c->bgr = c->format == AV_PIX_FMT_BGR0 || c->format == AV_PIX_FMT_BGRA;
+
+	return c;
+}
+
+void nhvd_converter_close(struct nhvd_converter *c)
+{
+	if(c == NULL)
+		return;
+
+	av_frame_free(&c->frame);
+	av_buffer_pool_uninit(&c->pool);
+	sws_freeContext(c->sws);
+	free(c->y);
+	free(c->u);
+	free(c->v);
+	free(c);
+}
+
+AVFrame *nhvd_converter_convert(struct nhvd_converter *c, AVFrame *in)
+{
+	AVFrame *out = c->frame;
+
+	if(in->format == c->format)
+		return in;
+
+	//the user may still reference previous frame, its buffer returns to pool
+	av_frame_unref(out);
+
+	if(nhvd_converter_buffer(c, in) != 0)
+		return NULL;
+
+	if(av_frame_copy_props(out, in) < 0)
+		return NULL;
+
+	if(nhvd_convert_kernel(c, in, out) == 0)
+		return out;
+
+	if(nhvd_convert_sws(c, in, out) == 0)
+		return out;
+
+	fprintf(stderr, "nhvd: failed to convert frame to %s\n", av_get_pix_fmt_name(c->format));
+
+	return NULL;
+}
+
+//pooled output buffer, no allocation per frame
+static int nhvd_converter_buffer(struct nhvd_converter *c, const AVFrame *in)
+{
+	const int size = av_image_get_buffer_size(c->format, in->width, in->height, NHVD_CONVERT_ALIGN);
+	AVFrame *out = c->frame;
+
+	if(size < 0)
+		return -1;
+
+	if(c->pool_size != size)
+	{
+		//the old pool is freed when its last buffer is returned
+		av_buffer_pool_uninit(&c->pool);
+		c->pool_size = 0;
+
+		if( (c->pool = av_buffer_pool_init(size, av_buffer_alloc)) == NULL)
+			return -1;
+
+		c->pool_size = size;
+	}
+
+	if( (out->buf[0] = av_buffer_pool_get(c->pool)) == NULL)
+		return -1;
+
+	out->format = c->format;
+	out->width = in->width;
+	out->height = in->height;
+
+	if(av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, c->format, in->width, in->height, NHVD_CONVERT_ALIGN) < 0)
+		return -1;
+
+	return 0;
+}
+
+//NV12, YUV420P and P010 to RGB0, BGR0, RGBA, BGRA, -1 if not handled
+static int nhvd_convert_kernel(struct nhvd_converter *c, const AVFrame *in, AVFrame *out)
+{
+	const int full_range = in->color_range == AVCOL_RANGE_JPEG;
+	const int bt709 = in->colorspace == AVCOL_SPC_BT709;
+	const struct nhvd_yuv_coeffs *k = bt709 ?
+		(full_range ? &NHVD_BT709_FULL : &NHVD_BT709_LIMITED) :
+		(full_range ? &NHVD_BT601_FULL : &NHVD_BT601_LIMITED);
+	const int chroma_width = (in->width + 1) / 2;
+
+	if(c->row == NULL)
+		return -1;
+
+	if(in->format != AV_PIX_FMT_YUV420P && in->format != AV_PIX_FMT_NV12 && in->format != AV_PIX_FMT_P010LE)
+		return -1;
+
+	if(nhvd_converter_rows(c, in->width) != 0)
+		return -1;
+
+	for(int row=0;row<in->height;++row)
+	{
+		const uint8_t *y = in->data[0] + row * in->linesize[0];
+		const uint8_t *chroma = in->data[1] + row / 2 * in->linesize[1];
+		const uint8_t *u = c->u, *v = c->v;
+		uint8_t *dst = out->data[0] + row * out->linesize[0];
+
+		if(in->format == AV_PIX_FMT_YUV420P)
+		{
+			u = chroma;
+			v = in->data[2] + row / 2 * in->linesize[2];
+		}
+		else if(in->format == AV_PIX_FMT_NV12)
+		{
+			//chroma row is shared by two rows
+			for(int x=0;!(row & 1) && x<chroma_width;++x)
+			{
+				c->u[x] = chroma[2 * x];
+				c->v[x] = chroma[2 * x + 1];
+			}
+		}
+		else //P010, 10 bits in most significant bits, reduce to 8 bits
+		{
+			const uint16_t *y16 = (const uint16_t*)y;
+			const uint16_t *uv16 = (const uint16_t*)chroma;
+
+			for(int x=0;x<in->width;++x)
+				c->y[x] = y16[x] >> 8;
+
+			for(int x=0;!(row & 1) && x<chroma_width;++x)
+			{
+				c->u[x] = uv16[2 * x] >> 8;
+				c->v[x] = uv16[2 * x + 1] >> 8;
+			}
+
+			y = c->y;
+		}
+
+		c->row(y, u, v, dst, 0, in->width, k, c->bgr);
+	}
+
+	return 0;
+}
+
+static int nhvd_convert_sws(struct nhvd_converter *c, const AVFrame *in, AVFrame *out)
+{
+	c->sws = sws_getCachedContext(c->sws, in->width, in->height, (enum AVPixelFormat)in->format,
+		out->width, out->height, c->format, SWS_BILINEAR, NULL, NULL, NULL);
+
+	if(c->sws == NULL)
+		return -1;
+
+	if(sws_scale(c->sws, (const uint8_t * const*)in->data, in->linesize, 0, in->height, out->data, out->linesize) != out->height)
+		return -1;
+
+	return 0;
+}
+
+static int nhvd_converter_rows(struct nhvd_converter *c, int width)
+{
+	if(width <= c->rows_width)
+		return 0;
+
+	free(c->y);
+	free(c->u);
+	free(c->v);
+	c->rows_width = 0;
+
+	//kernels may read chroma up to the next even pixel
+	if( (c->y = (uint8_t*)malloc(width + 1)) == NULL ||
+		(c->u = (uint8_t*)malloc(width / 2 + 1)) == NULL ||
+		(c->v = (uint8_t*)malloc(width / 2 + 1)) == NULL)
+		return -1;
+
+	c->rows_width = width;
+
+	return 0;
+}
+
+static inline uint8_t nhvd_clamp(int value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void nhvd_yuv_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	for(;x<width;++x)
+	{
+		const int ys = (y[x] - k->y_offset) * k->y + 32;
+		const int cu = u[x / 2] - 128;
+		const int cv = v[x / 2] - 128;
+		const uint8_t r = nhvd_clamp((ys + k->rv * cv) >> 6);
+		const uint8_t g = nhvd_clamp((ys - k->gu * cu - k->gv * cv) >> 6);
+		const uint8_t b = nhvd_clamp((ys + k->bu * cu) >> 6);
+
+		dst[4 * x + 0] = bgr ? b : r;
+		dst[4 * x + 1] = g;
+		dst[4 * x + 2] = bgr ? r : b;
+		dst[4 * x + 3] = 255;
+	}
+}
+
+#ifdef NHVD_X86
+
+//SSE2 is baseline on x86-64, 16 pixels per iteration
+__attribute__((target("sse2")))
+static void nhvd_yuv_row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi8(-1);
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i round = _mm_set1_epi16(32);
+	const __m128i y_offset = _mm_set1_epi16(k->y_offset);
+	const __m128i y_coef = _mm_set1_epi16(k->y);
+	const __m128i rv = _mm_set1_epi16(k->rv), gu = _mm_set1_epi16(k->gu);
+	const __m128i gv = _mm_set1_epi16(k->gv), bu = _mm_set1_epi16(k->bu);
+
+	for(;x + 16 <= width;x += 16)
+	{
+		const __m128i y8 = _mm_loadu_si128((const __m128i*)(y + x));
+		const __m128i u8 = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+		const __m128i v8 = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+		const __m128i uu = _mm_unpacklo_epi8(u8, u8); //each chroma sample for two pixels
+		const __m128i vv = _mm_unpacklo_epi8(v8, v8);
+		__m128i r[2], g[2], b[2];
+
+		for(int h=0;h<2;++h)
+		{
+			__m128i y16 = h ? _mm_unpackhi_epi8(y8, zero) : _mm_unpacklo_epi8(y8, zero);
+			const __m128i u16 = _mm_sub_epi16(h ? _mm_unpackhi_epi8(uu, zero) : _mm_unpacklo_epi8(uu, zero), c128);
+			const __m128i v16 = _mm_sub_epi16(h ? _mm_unpackhi_epi8(vv, zero) : _mm_unpacklo_epi8(vv, zero), c128);
+
+			y16 = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y16, y_offset), y_coef), round);
+
+			//saturation only happens for values clamped to 255 anyway
+			r[h] = _mm_srai_epi16(_mm_adds_epi16(y16, _mm_mullo_epi16(v16, rv)), 6);
+			g[h] = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(y16, _mm_mullo_epi16(u16, gu)), _mm_mullo_epi16(v16, gv)), 6);
+			b[h] = _mm_srai_epi16(_mm_adds_epi16(y16, _mm_mullo_epi16(u16, bu)), 6);
+		}
+
+		const __m128i R = _mm_packus_epi16(r[0], r[1]);
+		const __m128i G = _mm_packus_epi16(g[0], g[1]);
+		const __m128i B = _mm_packus_epi16(b[0], b[1]);
+		const __m128i t0 = _mm_unpacklo_epi8(bgr ? B : R, G);
+		const __m128i t1 = _mm_unpackhi_epi8(bgr ? B : R, G);
+		const __m128i t2 = _mm_unpacklo_epi8(bgr ? R : B, alpha);
+		const __m128i t3 = _mm_unpackhi_epi8(bgr ? R : B, alpha);
+		__m128i *out = (__m128i*)(dst + 4 * x);
+
+		_mm_storeu_si128(out + 0, _mm_unpacklo_epi16(t0, t2));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(t0, t2));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(t1, t3));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(t1, t3));
+	}
+
+	nhvd_yuv_row_c(y, u, v, dst, x, width, k, bgr);
+}
+
+//32 pixels per iteration, selected at runtime
+__attribute__((target("avx2")))
+static void nhvd_yuv_row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	const __m256i alpha = _mm256_set1_epi8(-1);
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i round = _mm256_set1_epi16(32);
+	const __m256i y_offset = _mm256_set1_epi16(k->y_offset);
+	const __m256i y_coef = _mm256_set1_epi16(k->y);
+	const __m256i rv = _mm256_set1_epi16(k->rv), gu = _mm256_set1_epi16(k->gu);
+	const __m256i gv = _mm256_set1_epi16(k->gv), bu = _mm256_set1_epi16(k->bu);
+
+	for(;x + 32 <= width;x += 32)
+	{
+		const __m128i u8 = _mm_loadu_si128((const __m128i*)(u + x / 2));
+		const __m128i v8 = _mm_loadu_si128((const __m128i*)(v + x / 2));
+		__m256i r[2], g[2], b[2];
+
+		for(int h=0;h<2;++h)
+		{
+			__m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x + 16 * h)));
+			const __m256i u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(h ? _mm_unpackhi_epi8(u8, u8) : _mm_unpacklo_epi8(u8, u8)), c128);
+			const __m256i v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(h ? _mm_unpackhi_epi8(v8, v8) : _mm_unpacklo_epi8(v8, v8)), c128);
+
+			y16 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y16, y_offset), y_coef), round);
+
+			r[h] = _mm256_srai_epi16(_mm256_adds_epi16(y16, _mm256_mullo_epi16(v16, rv)), 6);
+			g[h] = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y16, _mm256_mullo_epi16(u16, gu)), _mm256_mullo_epi16(v16, gv)), 6);
+			b[h] = _mm256_srai_epi16(_mm256_adds_epi16(y16, _mm256_mullo_epi16(u16, bu)), 6);
+		}
+
+		//pack works within 128 bit lanes, restore pixel order
+		const __m256i R = _mm256_permute4x64_epi64(_mm256_packus_epi16(r[0], r[1]), 0xD8);
+		const __m256i G = _mm256_permute4x64_epi64(_mm256_packus_epi16(g[0], g[1]), 0xD8);
+		const __m256i B = _mm256_permute4x64_epi64(_mm256_packus_epi16(b[0], b[1]), 0xD8);
+		const __m256i t0 = _mm256_unpacklo_epi8(bgr ? B : R, G);
+		const __m256i t1 = _mm256_unpackhi_epi8(bgr ? B : R, G);
+		const __m256i t2 = _mm256_unpacklo_epi8(bgr ? R : B, alpha);
+		const __m256i t3 = _mm256_unpackhi_epi8(bgr ? R : B, alpha);
+		const __m256i q0 = _mm256_unpacklo_epi16(t0, t2); //pixels 0-3, 16-19
+		const __m256i q1 = _mm256_unpackhi_epi16(t0, t2); //pixels 4-7, 20-23
+		const __m256i q2 = _mm256_unpacklo_epi16(t1, t3); //pixels 8-11, 24-27
+		const __m256i q3 = _mm256_unpackhi_epi16(t1, t3); //pixels 12-15, 28-31
+		__m256i *out = (__m256i*)(dst + 4 * x);
+
+		_mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(q0, q1, 0x20));
+		_mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(q2, q3, 0x20));
+		_mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(q0, q1, 0x31));
+		_mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(q2, q3, 0x31));
+	}
+
+	nhvd_yuv_row_sse2(y, u, v, dst, x, width, k, bgr);
+}
+
+static nhvd_yuv_row_fn nhvd_yuv_row_select(void)
+{
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+		return nhvd_yuv_row_avx2;
+
+	if(__builtin_cpu_supports("sse2"))
+		return nhvd_yuv_row_sse2;
+
+	return nhvd_yuv_row_c;
+}
+
+#elif defined(__ARM_NEON)
+
+//NEON is baseline on AArch64, 16 pixels per iteration
+static void nhvd_yuv_row_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+	int x, int width, const struct nhvd_yuv_coeffs *k, int bgr)
+{
+	const int16x8_t c128 = vdupq_n_s16(128);
+	const int16x8_t y_offset = vdupq_n_s16(k->y_offset);
+	const int16x8_t y_coef = vdupq_n_s16(k->y);
+	const int16x8_t rv = vdupq_n_s16(k->rv), gu = vdupq_n_s16(k->gu);
+	const int16x8_t gv = vdupq_n_s16(k->gv), bu = vdupq_n_s16(k->bu);
+
+	for(;x + 16 <= width;x += 16)
+	{
+		const uint8x16_t y8 = vld1q_u8(y + x);
+		const uint8x8x2_t uu = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+		const uint8x8x2_t vv = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+		int16x8_t r[2], g[2], b[2];
+		uint8x16x4_t out;
+
+		for(int h=0;h<2;++h)
+		{
+			int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(h ? vget_high_u8(y8) : vget_low_u8(y8)));
+			const int16x8_t u16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uu.val[h])), c128);
+			const int16x8_t v16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vv.val[h])), c128);
+
+			y16 = vmulq_s16(vsubq_s16(y16, y_offset), y_coef);
+
+			r[h] = vqaddq_s16(y16, vmulq_s16(v16, rv));
+			g[h] = vqsubq_s16(vqsubq_s16(y16, vmulq_s16(u16, gu)), vmulq_s16(v16, gv));
+			b[h] = vqaddq_s16(y16, vmulq_s16(u16, bu));
+		}
+
+		//rounding shift with saturation to 0-255
+		const uint8x16_t R = vcombine_u8(vqrshrun_n_s16(r[0], 6), vqrshrun_n_s16(r[1], 6));
+		const uint8x16_t G = vcombine_u8(vqrshrun_n_s16(g[0], 6), vqrshrun_n_s16(g[1], 6));
+		const uint8x16_t B = vcombine_u8(vqrshrun_n_s16(b[0], 6), vqrshrun_n_s16(b[1], 6));
+
+		out.val[0] = bgr ? B : R;
+		out.val[1] = G;
+		out.val[2] = bgr ? R : B;
+		out.val[3] = vdupq_n_u8(255);
+
+		vst4q_u8(dst + 4 * x, out);
+	}
+
+	nhvd_yuv_row_c(y, u, v, dst, x, width, k, bgr);
+}
+
+static nhvd_yuv_row_fn nhvd_yuv_row_select(void)
+{
+	return nhvd_yuv_row_neon;
+}
+
+#else
+
+static nhvd_yuv_row_fn nhvd_yuv_row_select(void)
+{
+	return nhvd_yuv_row_c;
+}
+
+#endif
+
+static struct nhvd_converter *nhvd_converter_close_and_return_null(struct nhvd_converter *c, const char *msg)
+{
+	if(msg)
+		fprintf(stderr, "nhvd: %s\n", msg);
+
+	nhvd_converter_close(c);
+
+	return NULL;
+}
@@ -0,0 +1,29 @@
+/*
+ * NHVD Network Hardware Video Decoder color conversion internal header
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#ifndef NHVD_CONVERT_H
+#define NHVD_CONVERT_H
+
+//internal, not part of the public interface
+
+#include <libavutil/frame.h>
+
+struct nhvd_converter;
+
+//NULL on error (e.g. unknown pixel format), errors printed to stderr
+struct nhvd_converter *nhvd_converter_init(const char *output_format);
+void nhvd_converter_close(struct nhvd_converter *c);
+
+//frame in output format, owned by converter and valid until next call, NULL on error
+//the frame is returned as is if already in output format
+AVFrame *nhvd_converter_convert(struct nhvd_converter *c, AVFrame *frame);
+
+#endif
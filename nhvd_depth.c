@@ -0,0 +1,234 @@
+/*
+ * NHVD Network Hardware Video Decoder depth unprojection implementation
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "nhvd.h"
+
+#include <libavutil/pixfmt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NHVD_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum { NHVD_POINT_CLOUD_ALIGN = 64 };
+
+static void nhvd_unproject_row(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int width, int row);
+static void nhvd_unproject_row_c(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int x, int width, float y_factor);
+static int nhvd_point_cloud_reserve(struct nhvd_point_cloud *pc, int size, int colors);
+static int NHVD_DEPTH_ERROR_MSG(const char *msg);
+
+int nhvd_unproject_depth(const struct nhvd_depth_config *config, const AVFrame *depth,
+	const AVFrame *texture, struct nhvd_point_cloud *pc)
+{
+	const int width = depth->width, height = depth->height;
+
+	//16 bit depth in luma plane
+	if(depth->format != AV_PIX_FMT_P010LE && depth->format != AV_PIX_FMT_GRAY16LE)
+		return NHVD_DEPTH_ERROR_MSG("depth has to be p010le or gray16le");
+
+	if(config->fx == 0.0f || config->fy == 0.0f)
+		return NHVD_DEPTH_ERROR_MSG("depth focal lengths have to be non-zero");
+
+	if(texture && (texture->width != width || texture->height != height))
+		return NHVD_DEPTH_ERROR_MSG("texture has to match depth resolution");
+
+	if(texture && texture->format != AV_PIX_FMT_RGB0 && texture->format != AV_PIX_FMT_BGR0 &&
+		texture->format != AV_PIX_FMT_RGBA && texture->format != AV_PIX_FMT_BGRA)
+		return NHVD_DEPTH_ERROR_MSG("texture has to be 4 byte per pixel (e.g. output_format bgr0)");
+
+	if(nhvd_point_cloud_reserve(pc, width * height, texture != NULL) != NHVD_OK)
+		return NHVD_DEPTH_ERROR_MSG("not enough memory for point cloud");
+
+	for(int row=0;row<height;++row)
+	{
+		const uint16_t *depth_row = (const uint16_t*)(depth->data[0] + row * depth->linesize[0]);
+
+		nhvd_unproject_row(config, depth_row, pc->data + row * width, width, row);
+
+		if(texture)
+			memcpy(pc->colors + row * width, texture->data[0] + row * texture->linesize[0], width * sizeof(uint32_t));
+	}
+
+	pc->used = width * height;
+
+	return NHVD_OK;
+}
+
+void nhvd_point_cloud_free(struct nhvd_point_cloud *pc)
+{
+	struct nhvd_point_cloud zero_pc = {0};
+
+	free(pc->data);
+	free(pc->colors);
+
+	*pc = zero_pc;
+}
+
+//reused between calls, grown only when resolution increases
+static int nhvd_point_cloud_reserve(struct nhvd_point_cloud *pc, int size, int colors)
+{
+	const size_t data_size = ((size * sizeof(float[3])) / NHVD_POINT_CLOUD_ALIGN + 1) * NHVD_POINT_CLOUD_ALIGN;
+
+	if(pc->size < size)
+	{
+		free(pc->data);
+		free(pc->colors);
+		pc->colors = NULL;
+		pc->size = 0;
+
+		if( (pc->data = (float(*)[3])aligned_alloc(NHVD_POINT_CLOUD_ALIGN, data_size)) == NULL)
+			return NHVD_ERROR;
+
+		pc->size = size;
+	}
+
+	//no stale colors from previous call with texture
+	if(!colors)
+	{
+		free(pc->colors);
+		pc->colors = NULL;
+	}
+	else if(pc->colors == NULL)
+	{
+		//for allocated points, not the current size, colors are not grown without data
+		const size_t colors_size = ((pc->size * sizeof(uint32_t)) / NHVD_POINT_CLOUD_ALIGN + 1) * NHVD_POINT_CLOUD_ALIGN;
+
+		if( (pc->colors = (uint32_t*)aligned_alloc(NHVD_POINT_CLOUD_ALIGN, colors_size)) == NULL)
+			return NHVD_ERROR;
+	}
+
+	return NHVD_OK;
+}
+
+static void nhvd_unproject_row_c(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int x, int width, float y_factor)
+{
+	for(;x<width;++x)
+	{
+		float z = depth[x] * config->depth_unit;
+
+		//no depth or outside of the range
+		if(z <= config->min_margin || (config->max_margin > 0.0f && z >= config->max_margin))
+			z = 0.0f;
+
+		points[x][0] = (x - config->ppx) / config->fx * z;
+		points[x][1] = y_factor * z;
+		points[x][2] = z;
+	}
+}
+
+#ifdef NHVD_X86
+
+//SSE2 is baseline on x86-64, 4 points per iteration
+__attribute__((target("sse2")))
+static void nhvd_unproject_row(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int width, int row)
+{
+	const float y_factor = (row - config->ppy) / config->fy;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 unit = _mm_set1_ps(config->depth_unit);
+	const __m128 min_margin = _mm_set1_ps(config->min_margin);
+	const __m128 max_margin = _mm_set1_ps(config->max_margin > 0.0f ? config->max_margin : __FLT_MAX__);
+	const __m128 inv_fx = _mm_set1_ps(1.0f / config->fx);
+	const __m128 y_factors = _mm_set1_ps(y_factor);
+	const __m128 step = _mm_set1_ps(4.0f);
+	__m128 u = _mm_sub_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_set1_ps(config->ppx));
+	int x = 0;
+
+	for(;x + 4 <= width;x += 4)
+	{
+		const __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + x)), zero);
+		__m128 z = _mm_mul_ps(_mm_cvtepi32_ps(d), unit);
+		const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(z, min_margin), _mm_cmplt_ps(z, max_margin));
+
+		z = _mm_and_ps(z, valid);
+
+		const __m128 px = _mm_mul_ps(_mm_mul_ps(u, inv_fx), z);
+		const __m128 py = _mm_mul_ps(y_factors, z);
+
+		//xyz xyz xyz xyz from x, y and z vectors
+		const __m128 xy_lo = _mm_unpacklo_ps(px, py); //x0 y0 x1 y1
+		const __m128 xy_hi = _mm_unpackhi_ps(px, py); //x2 y2 x3 y3
+		const __m128 zx = _mm_shuffle_ps(z, px, _MM_SHUFFLE(1, 1, 0, 0)); //z0 z0 x1 x1
+		const __m128 yz = _mm_shuffle_ps(py, z, _MM_SHUFFLE(1, 1, 1, 1)); //y1 y1 z1 z1
+		const __m128 zx_hi = _mm_shuffle_ps(z, xy_hi, _MM_SHUFFLE(2, 2, 2, 2)); //z2 z2 x3 x3
+		const __m128 yz_hi = _mm_shuffle_ps(xy_hi, z, _MM_SHUFFLE(3, 3, 3, 3)); //y3 y3 z3 z3
+		float *out = points[x];
+
+		_mm_storeu_ps(out + 0, _mm_shuffle_ps(xy_lo, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+		_mm_storeu_ps(out + 4, _mm_shuffle_ps(yz, xy_hi, _MM_SHUFFLE(1, 0, 2, 0)));
+		_mm_storeu_ps(out + 8, _mm_shuffle_ps(zx_hi, yz_hi, _MM_SHUFFLE(2, 0, 2, 0)));
+
+		u = _mm_add_ps(u, step);
+	}
+
+	nhvd_unproject_row_c(config, depth, points, x, width, y_factor);
+}
+
+#elif defined(__ARM_NEON)
+
+//NEON is baseline on AArch64, 4 points per iteration, interleaved store
+static void nhvd_unproject_row(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int width, int row)
+{
+	const float y_factor = (row - config->ppy) / config->fy;
+	const float32x4_t unit = vdupq_n_f32(config->depth_unit);
+	const float32x4_t min_margin = vdupq_n_f32(config->min_margin);
+	const float32x4_t max_margin = vdupq_n_f32(config->max_margin > 0.0f ? config->max_margin : __FLT_MAX__);
+	const float32x4_t inv_fx = vdupq_n_f32(1.0f / config->fx);
+	const float32x4_t step = vdupq_n_f32(4.0f);
+	const float u_init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+	float32x4_t u = vsubq_f32(vld1q_f32(u_init), vdupq_n_f32(config->ppx));
+	int x = 0;
+
+	for(;x + 4 <= width;x += 4)
+	{
+		float32x4_t z = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(depth + x))), unit);
+		const uint32x4_t valid = vandq_u32(vcgtq_f32(z, min_margin), vcltq_f32(z, max_margin));
+		float32x4x3_t xyz;
+
+		z = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(z), valid));
+
+		xyz.val[0] = vmulq_f32(vmulq_f32(u, inv_fx), z);
+		xyz.val[1] = vmulq_n_f32(z, y_factor);
+		xyz.val[2] = z;
+
+		vst3q_f32(points[x], xyz);
+
+		u = vaddq_f32(u, step);
+	}
+
+	nhvd_unproject_row_c(config, depth, points, x, width, y_factor);
+}
+
+#else
+
+static void nhvd_unproject_row(const struct nhvd_depth_config *config, const uint16_t *depth,
+	float (*points)[3], int width, int row)
+{
+	nhvd_unproject_row_c(config, depth, points, 0, width, (row - config->ppy) / config->fy);
+}
+
+#endif
+
+static int NHVD_DEPTH_ERROR_MSG(const char *msg)
+{
+	fprintf(stderr, "nhvd: %s\n", msg);
+	return NHVD_ERROR;
+}
@@ -0,0 +1,382 @@
+/*
+ * NHVD Network Hardware Video Decoder multi-stream server implementation
+ *
+ * Copyright 2020 (C) Bartosz Meglicki <meglickib@gmail.com>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ */
+
+#include "nhvd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h> //sysconf
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+enum { NHVD_SERVER_RECEIVE_QUEUE_SIZE = 2 }; //default if stream doesn't set receive_queue_size
+
+enum nhvd_stream_state_enum
+{
+	NHVD_STREAM_IDLE, //waiting for data, armed in epoll
+	NHVD_STREAM_READY, //waiting for worker
+	NHVD_STREAM_RUNNING, //served by worker
+	NHVD_STREAM_FAILED, //not served anymore
+};
+
+struct nhvd_server_stream
+{
+	struct nhvd *n;
+	int fd;
+	int hw_size;
+
+	AVFrame **frames; //hw_size
+	struct nhvd_frame *raws; //hw_size + aux_size
+
+	int state; //nhvd_stream_state_enum
+	int priority;
+	uint64_t ready_seq; //order of becoming ready, round robin within priority
+};
+
+struct nhvd_server
+{
+	struct nhvd_server_stream *stream;
+	int streams_size;
+
+	nhvd_server_callback callback;
+	void *user;
+
+	int epoll_fd;
+	int stop_fd; //wakes up dispatcher on close
+
+	pthread_mutex_t mutex; //protects stream state and priority
+	pthread_cond_t ready; //signalled when stream becomes ready
+	int sync_initialized;
+	int keep_working;
+	uint64_t ready_seq;
+
+	pthread_t dispatcher;
+	int dispatcher_running;
+
+	pthread_t *worker;
+	int workers_size;
+	int workers_running;
+};
+
+static void *nhvd_server_dispatcher_thread(void *arg);
+static void *nhvd_server_worker_thread(void *arg);
+static struct nhvd_server_stream *nhvd_server_next_stream(struct nhvd_server *s);
+static void nhvd_server_serve(struct nhvd_server *s, struct nhvd_server_stream *stream);
+static int nhvd_server_arm(struct nhvd_server *s, struct nhvd_server_stream *stream, int op);
+static struct nhvd_server *nhvd_server_close_and_return_null(struct nhvd_server *s, const char *msg);
+
+struct nhvd_server *nhvd_server_init(const struct nhvd_server_config *config,
+	const struct nhvd_stream_config *streams, int streams_size)
+{
+	struct nhvd_server *s, zero_server = {0};
+
+	if(streams_size <= 0 || config->callback == NULL)
+		return nhvd_server_close_and_return_null(NULL, "server requires streams and callback");
+
+	if( (s = (struct nhvd_server*)malloc(sizeof(struct nhvd_server))) == NULL)
+		return nhvd_server_close_and_return_null(NULL, "not enough memory for server");
+
+	*s = zero_server;
+	s->epoll_fd = s->stop_fd = -1;
+	s->callback = config->callback;
+	s->user = config->user;
+	s->workers_size = config->workers > 0 ? config->workers : sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(s->workers_size <= 0)
+		s->workers_size = 1;
+
+	if( (s->stream = (struct nhvd_server_stream*)calloc(streams_size, sizeof(struct nhvd_server_stream))) == NULL ||
+		(s->worker = (pthread_t*)calloc(s->workers_size, sizeof(pthread_t))) == NULL)
+		return nhvd_server_close_and_return_null(s, "not enough memory for server");
+
+	s->streams_size = streams_size;
+
+	for(int i=0;i<streams_size;++i)
+	{
+		struct nhvd_server_stream *stream = &s->stream[i];
+		struct nhvd_net_config net_config = streams[i].net_config;
+
+		//non-blocking receive needs network thread
+		if(!net_config.receive_queue_size)
+			net_config.receive_queue_size = NHVD_SERVER_RECEIVE_QUEUE_SIZE;
+		//workers already use all the cores
+		if(!net_config.software_threads)
+			net_config.software_threads = 1;
+
+		stream->priority = streams[i].priority;
+		stream->hw_size = streams[i].hw_size;
+
+		if( (stream->n = nhvd_init(&net_config, streams[i].hw_config, streams[i].hw_size, streams[i].aux_size)) == NULL)
+			return nhvd_server_close_and_return_null(s, "failed to initialize stream");
+
+		if( (stream->frames = (AVFrame**)calloc(streams[i].hw_size + 1, sizeof(AVFrame*))) == NULL ||
+			(stream->raws = (struct nhvd_frame*)calloc(streams[i].hw_size + streams[i].aux_size + 1, sizeof(struct nhvd_frame))) == NULL)
+			return nhvd_server_close_and_return_null(s, "not enough memory for stream");
+
+		stream->fd = nhvd_get_fd(stream->n);
+	}
+
+	if(pthread_mutex_init(&s->mutex, NULL) != 0)
+		return nhvd_server_close_and_return_null(s, "failed to initialize server mutex");
+
+	if(pthread_cond_init(&s->ready, NULL) != 0)
+	{
+		pthread_mutex_destroy(&s->mutex);
+		return nhvd_server_close_and_return_null(s, "failed to initialize server condition");
+	}
+
+	s->sync_initialized = 1;
+	s->keep_working = 1;
+
+	if( (s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+		(s->stop_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+		return nhvd_server_close_and_return_null(s, "failed to create server event descriptors");
+
+	struct epoll_event stop_event = {0};
+	stop_event.events = EPOLLIN;
+	stop_event.data.ptr = NULL;
+
+	if(epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->stop_fd, &stop_event) != 0)
+		return nhvd_server_close_and_return_null(s, "failed to watch server stop descriptor");
+
+	for(int i=0;i<streams_size;++i)
+		if(nhvd_server_arm(s, &s->stream[i], EPOLL_CTL_ADD) != NHVD_OK)
+			return nhvd_server_close_and_return_null(s, "failed to watch stream descriptor");
+
+	for(; s->workers_running < s->workers_size; ++s->workers_running)
+		if(pthread_create(&s->worker[s->workers_running], NULL, nhvd_server_worker_thread, s) != 0)
+			return nhvd_server_close_and_return_null(s, "failed to create server worker thread");
+
+	if(pthread_create(&s->dispatcher, NULL, nhvd_server_dispatcher_thread, s) != 0)
+		return nhvd_server_close_and_return_null(s, "failed to create server dispatcher thread");
+
+	s->dispatcher_running = 1;
+
+	return s;
+}
+
+int nhvd_server_close(struct nhvd_server *s)
+{
+	const uint64_t stop = 1;
+
+	if(s == NULL)
+		return NHVD_OK;
+
+	//worker can't join itself, it would wait forever
+	for(int i=0;i<s->workers_running;++i)
+		if(pthread_equal(pthread_self(), s->worker[i]))
+		{
+			fprintf(stderr, "nhvd: server can't be closed from its callback\n");
+			return NHVD_ERROR;
+		}
+
+	if(s->sync_initialized)
+	{
+		pthread_mutex_lock(&s->mutex);
+		s->keep_working = 0;
+		pthread_cond_broadcast(&s->ready);
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	if(s->dispatcher_running)
+	{
+		while(write(s->stop_fd, &stop, sizeof(stop)) < 0 && errno == EINTR)
+			;
+		pthread_join(s->dispatcher, NULL);
+	}
+
+	for(int i=0;i<s->workers_running;++i)
+		pthread_join(s->worker[i], NULL);
+
+	if(s->sync_initialized)
+	{
+		pthread_cond_destroy(&s->ready);
+		pthread_mutex_destroy(&s->mutex);
+	}
+
+	if(s->epoll_fd != -1)
+		close(s->epoll_fd);
+
+	if(s->stop_fd != -1)
+		close(s->stop_fd);
+
+	for(int i=0;s->stream && i<s->streams_size;++i)
+	{
+		nhvd_close(s->stream[i].n);
+		free(s->stream[i].frames);
+		free(s->stream[i].raws);
+	}
+
+	free(s->stream);
+	free(s->worker);
+	free(s);
+
+	return NHVD_OK;
+}
+
+int nhvd_server_set_priority(struct nhvd_server *s, int stream, int priority)
+{
+	if(stream < 0 || stream >= s->streams_size)
+		return NHVD_ERROR;
+
+	pthread_mutex_lock(&s->mutex);
+	s->stream[stream].priority = priority;
+	pthread_mutex_unlock(&s->mutex);
+
+	return NHVD_OK;
+}
+
+//moves streams with data from epoll to ready streams
+static void *nhvd_server_dispatcher_thread(void *arg)
+{
+	struct nhvd_server *s = (struct nhvd_server*)arg;
+	struct epoll_event events[64];
+	int ready;
+
+	while(1)
+	{
+		if( (ready = epoll_wait(s->epoll_fd, events, 64, -1)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			fprintf(stderr, "nhvd: server epoll failed\n");
+			break;
+		}
+
+		pthread_mutex_lock(&s->mutex);
+
+		for(int i=0;i<ready;++i)
+		{
+			struct nhvd_server_stream *stream = (struct nhvd_server_stream*)events[i].data.ptr;
+
+			if(stream == NULL)
+			{
+				pthread_mutex_unlock(&s->mutex);
+				return NULL; //closing
+			}
+
+			//one shot, the stream is not reported again until rearmed by worker
+			stream->state = NHVD_STREAM_READY;
+			stream->ready_seq = s->ready_seq++;
+			pthread_cond_signal(&s->ready);
+		}
+
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	return NULL;
+}
+
+static void *nhvd_server_worker_thread(void *arg)
+{
+	struct nhvd_server *s = (struct nhvd_server*)arg;
+	struct nhvd_server_stream *stream;
+
+	pthread_mutex_lock(&s->mutex);
+
+	while(s->keep_working)
+	{
+		if( (stream = nhvd_server_next_stream(s)) == NULL)
+		{
+			pthread_cond_wait(&s->ready, &s->mutex);
+			continue;
+		}
+
+		stream->state = NHVD_STREAM_RUNNING;
+		pthread_mutex_unlock(&s->mutex);
+
+		nhvd_server_serve(s, stream);
+
+		pthread_mutex_lock(&s->mutex);
+	}
+
+	pthread_mutex_unlock(&s->mutex);
+
+	return NULL;
+}
+
+//highest priority ready stream, the longest waiting among equal priorities, called with mutex
+static struct nhvd_server_stream *nhvd_server_next_stream(struct nhvd_server *s)
+{
+	struct nhvd_server_stream *next = NULL;
+
+	for(int i=0;i<s->streams_size;++i)
+	{
+		struct nhvd_server_stream *stream = &s->stream[i];
+
+		if(stream->state != NHVD_STREAM_READY)
+			continue;
+
+		if(!next || stream->priority > next->priority ||
+			(stream->priority == next->priority && stream->ready_seq < next->ready_seq))
+			next = stream;
+	}
+
+	return next;
+}
+
+//decode single frame set and requeue the stream so other streams get their turn
+static void nhvd_server_serve(struct nhvd_server *s, struct nhvd_server_stream *stream)
+{
+	const int status = nhvd_receive_nonblock(stream->n, stream->frames, stream->raws);
+
+	if(status != NHVD_WOULD_BLOCK)
+		s->callback(stream - s->stream, status == NHVD_OK ? stream->frames : NULL,
+		status == NHVD_OK ? stream->raws : NULL, status, s->user);
+
+	pthread_mutex_lock(&s->mutex);
+
+	if(status == NHVD_WOULD_BLOCK)
+	{
+		stream->state = NHVD_STREAM_IDLE;
+
+		if(nhvd_server_arm(s, stream, EPOLL_CTL_MOD) != NHVD_OK)
+			stream->state = NHVD_STREAM_FAILED;
+	}
+	else if(status == NHVD_ERROR)
+		stream->state = NHVD_STREAM_FAILED;
+	else
+	{
+		stream->state = NHVD_STREAM_READY;
+		stream->ready_seq = s->ready_seq++;
+	}
+
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static int nhvd_server_arm(struct nhvd_server *s, struct nhvd_server_stream *stream, int op)
+{
+	struct epoll_event event = {0};
+
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = stream;
+
+	if(epoll_ctl(s->epoll_fd, op, stream->fd, &event) != 0)
+	{
+		fprintf(stderr, "nhvd: failed to watch stream descriptor\n");
+		return NHVD_ERROR;
+	}
+
+	return NHVD_OK;
+}
+
+static struct nhvd_server *nhvd_server_close_and_return_null(struct nhvd_server *s, const char *msg)
+{
+	if(msg)
+		fprintf(stderr, "nhvd: %s\n", msg);
+
+	nhvd_server_close(s);
+
+	return NULL;
+}